@@ -0,0 +1,475 @@
+/******************************************************************************
+Filename    : S51_bench.c
+Author      : pry
+Date        : 16/10/2026
+Description : The cycle benchmark application of the RTOS-MV, to be run on the
+              s51 simulator of ucsim (see s51_bench.sh). Timer 0 counts machine
+              cycles around each kernel path, and the results are printed on 
+              the serial port as CSV lines:
+              bench,param,cycles
+              switch,<ready threads>,<cycles of one full lap of switches>
+              switch_to,<ready threads>,<cycles of two direct handoffs>
+              signal,<pending user signals>,<cycles of _Sys_Signal_Handler>
+              malloc,<holes skipped>,<cycles of __Sys_Malloc>
+              mfree,<holes skipped>,<cycles of __Sys_Mfree>
+              memset_byte,<bytes>,<cycles of a plain one-byte loop, for reference>
+              memset,<bytes>,<cycles of Sys_Memset_Xdata>
+              memcpy,<bytes>,<cycles of Sys_Memcpy_Xdata>
+              The output ends with a line starting with "# done".
+******************************************************************************/
+
+/* Includes ******************************************************************/
+#include "sysconfig.h"
+#include "KERNEL.H"
+/* End Includes **************************************************************/
+
+/* Defines *******************************************************************/
+/* Stack size of each extra thread the switch benchmark starts */
+#define BENCH_STACK_SIZE            10
+/* How many extra threads are there - all except Init and Task1 */
+#define BENCH_EXTRA_THREADS         (MAX_THREADS-2)
+/* The allocation size used by the allocator benchmark, in pages */
+#define BENCH_MALLOC_PAGES          2
+/* The largest block the memory primitives are measured on */
+#define BENCH_MEM_BYTES             256
+/* End Defines ***************************************************************/
+
+/* Global Variables **********************************************************/
+/* The stacks of the extra threads */
+idata u8 Bench_Stack[BENCH_EXTRA_THREADS+1][BENCH_STACK_SIZE];
+/* The blocks used to fragment the heap */
+void xdata* xdata Bench_Block[DMEM_PAGES];
+/* The blocks the memory primitives work on */
+xdata u8 Bench_Buf[2][BENCH_MEM_BYTES];
+/* The cost of starting and stopping the timer itself */
+xdata u16 Bench_Overhead;
+/* The thread the handoff partner hands the processor back to */
+xdata tid_t Bench_Driver;
+/* End Global Variables ******************************************************/
+
+/* Begin Function:Bench_Putchar ***********************************************
+Description : Send a character through the serial port, by polling.
+Input       : s8 Char - The character.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Putchar(s8 Char)
+{
+    SBUF=Char;
+    while(TI==0);
+    TI=0;
+}
+/* End Function:Bench_Putchar ************************************************/
+
+/* Begin Function:Bench_Print_Str *********************************************
+Description : Send a string through the serial port.
+Input       : s8 code* Str - The string.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Print_Str(s8 code* Str)
+{
+    while(*Str!='\0')
+        Bench_Putchar(*Str++);
+}
+/* End Function:Bench_Print_Str **********************************************/
+
+/* Begin Function:Bench_Print_Uint ********************************************
+Description : Send an unsigned integer in decimal through the serial port.
+Input       : u32 Value - The integer.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Print_Uint(u32 Value)
+{
+    s8 Buf[10];
+    cnt_t Digit_Cnt;
+
+    Digit_Cnt=0;
+    do
+    {
+        Buf[Digit_Cnt++]='0'+Value%10;
+        Value/=10;
+    }
+    while(Value!=0);
+
+    while(Digit_Cnt>0)
+        Bench_Putchar(Buf[--Digit_Cnt]);
+}
+/* End Function:Bench_Print_Uint *********************************************/
+
+/* Begin Function:Bench_Print_Result ******************************************
+Description : Send one CSV result line.
+Input       : s8 code* Name - The benchmark name.
+              u32 Param - The benchmark parameter.
+              u32 Cycles - The measured machine cycles.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Print_Result(s8 code* Name,u32 Param,u32 Cycles)
+{
+    Bench_Print_Str(Name);
+    Bench_Putchar(',');
+    Bench_Print_Uint(Param);
+    Bench_Putchar(',');
+    Bench_Print_Uint(Cycles);
+    Bench_Putchar('\n');
+}
+/* End Function:Bench_Print_Result *******************************************/
+
+/* Begin Function:Bench_Timer_Start *******************************************
+Description : Clear Timer 0 and start counting machine cycles.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Timer_Start(void)
+{
+    TR0=0;
+    TH0=0;
+    TL0=0;
+    TF0=0;
+    TR0=1;
+}
+/* End Function:Bench_Timer_Start ********************************************/
+
+/* Begin Function:Bench_Timer_Stop ********************************************
+Description : Stop Timer 0 and read the cycles counted since Bench_Timer_Start,
+              less the cost of the two calls themselves.
+Input       : None.
+Output      : None.
+Return      : u32 - The machine cycles.
+******************************************************************************/
+u32 Bench_Timer_Stop(void)
+{
+    u32 Cycles;
+
+    TR0=0;
+    Cycles=(((u16)TH0)<<8)|TL0;
+    /* One overflow at most - the measured paths are far shorter than that */
+    if(TF0!=0)
+        Cycles+=0x10000;
+
+    return Cycles-Bench_Overhead;
+}
+/* End Function:Bench_Timer_Stop *********************************************/
+
+/* Begin Function:Bench_Init **************************************************
+Description : Set up Timer 0 as a 16-bit cycle counter, the serial port for 
+              output, and measure the timer overhead.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Init(void)
+{
+    /* Timer 0 in mode 1 (16-bit), Timer 1 in mode 2 (8-bit auto reload) as 
+     * the baud rate generator, 9600 baud at 11.0592MHz.
+     */
+    TMOD=0x21;
+    TH1=0xFD;
+    TL1=0xFD;
+    TR1=1;
+    SCON=0x52;
+    TI=0;
+
+    Bench_Overhead=0;
+    Bench_Timer_Start();
+    Bench_Overhead=Bench_Timer_Stop();
+
+    Bench_Print_Str("bench,param,cycles\n");
+}
+/* End Function:Bench_Init ***************************************************/
+
+/* Begin Function:Bench_Switch_To *********************************************
+Description : Measure Sys_Switch_To. A partner thread hands the processor
+              straight back, so the measured call returns after two handoffs,
+              while Init stays ready and is passed over both times.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Switch_To(void)
+{
+    struct Thread_Init_Struct Thread;
+    tid_t TID;
+
+    Bench_Driver=Sys_Get_TID();
+    Thread.TID=AUTO_PID;
+    Thread.Thread_Name="Partner";
+    Thread.Init_SP=(ptr_int_t)Bench_Stack[BENCH_EXTRA_THREADS];
+    Thread.Entrance=(ptr_int_t)Task3;
+#if(ENABLE_STACK_CHECK==TRUE)
+    Thread.Stack_Size=BENCH_STACK_SIZE;
+#endif
+#if(ENABLE_PRIORITY==TRUE)
+    Thread.Prio=TCB[Bench_Driver].Prio;
+#endif
+    TID=Sys_Start_Thread(&Thread);
+    Sys_Set_Ready(TID);
+
+    /* Let the partner start and park itself first */
+    Sys_Switch_To(TID);
+    Bench_Timer_Start();
+    Sys_Switch_To(TID);
+    Bench_Print_Result("switch_to",3,Bench_Timer_Stop());
+
+    Sys_Send_Signal(TID,SIGKILL);
+}
+/* End Function:Bench_Switch_To **********************************************/
+
+/* Begin Function:Bench_Switch ************************************************
+Description : Measure Sys_Switch_Now with 1 to MAX_THREADS ready threads. Every
+              other ready thread only yields, so the measured call returns after
+              exactly one lap of the ready list. With only this thread ready, or
+              only this thread and Init, the call takes the no-switch fast path.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Switch(void)
+{
+    struct Thread_Init_Struct Thread;
+    cnt_t Ready_Cnt;
+    tid_t TID;
+
+    /* With only this thread ready, the switch comes back to it */
+    _Sys_Thread_Sleep(0);
+    Bench_Timer_Start();
+    Sys_Switch_Now();
+    Bench_Print_Result("switch",1,Bench_Timer_Stop());
+
+    /* Put Init back, then add the yielding threads one by one */
+    _Sys_Thread_Wake(0);
+    for(Ready_Cnt=2;Ready_Cnt<=MAX_THREADS;Ready_Cnt++)
+    {
+        if(Ready_Cnt>2)
+        {
+            Thread.TID=AUTO_PID;
+            Thread.Thread_Name="Yield";
+            Thread.Init_SP=(ptr_int_t)Bench_Stack[Ready_Cnt-3];
+            Thread.Entrance=(ptr_int_t)Task2;
+#if(ENABLE_STACK_CHECK==TRUE)
+            Thread.Stack_Size=BENCH_STACK_SIZE;
+#endif
+#if(ENABLE_PRIORITY==TRUE)
+            /* Same priority as this thread, so that they take turns */
+            Thread.Prio=TCB[Sys_Get_TID()].Prio;
+#endif
+            TID=Sys_Start_Thread(&Thread);
+            Sys_Set_Ready(TID);
+        }
+
+        /* Let the thread settle in the list first */
+        Sys_Switch_Now();
+        Bench_Timer_Start();
+        Sys_Switch_Now();
+        Bench_Print_Result("switch",Ready_Cnt,Bench_Timer_Stop());
+    }
+}
+/* End Function:Bench_Switch *************************************************/
+
+/* Begin Function:Bench_Empty_Handler *****************************************
+Description : An empty user signal handler.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Empty_Handler(void)
+{
+    return;
+}
+/* End Function:Bench_Empty_Handler ******************************************/
+
+/* Begin Function:Bench_Signal ************************************************
+Description : Measure _Sys_Signal_Handler with 0 to USER_SIGNALS user signals 
+              pending, all of them with an empty handler registered.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Signal(void)
+{
+    tid_t TID;
+    cnt_t Pend_Cnt;
+    cnt_t Sig_Cnt;
+
+    TID=Sys_Get_TID();
+    for(Sig_Cnt=0;Sig_Cnt<USER_SIGNALS;Sig_Cnt++)
+        Sys_Reg_Signal_Handler(TID,SIGUSR1+Sig_Cnt,Bench_Empty_Handler);
+
+    for(Pend_Cnt=0;Pend_Cnt<=USER_SIGNALS;Pend_Cnt++)
+    {
+        for(Sig_Cnt=0;Sig_Cnt<Pend_Cnt;Sig_Cnt++)
+            Sys_Send_Signal(TID,SIGUSR1+Sig_Cnt);
+
+        Bench_Timer_Start();
+        _Sys_Signal_Handler(TID);
+        Bench_Print_Result("signal",Pend_Cnt,Bench_Timer_Stop());
+    }
+}
+/* End Function:Bench_Signal *************************************************/
+
+/* Begin Function:Bench_Fragment **********************************************
+Description : Fragment the heap on purpose: fill it with single-page blocks, 
+              then free every other one of the first blocks, and all blocks 
+              after them. The allocator then sees that many holes too small for
+              the request before the free tail of the heap.
+Input       : tid_t TID - The owner of the blocks.
+              cnt_t Level - The number of holes.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Fragment(tid_t TID,cnt_t Level)
+{
+    cnt_t Block_Cnt;
+    cnt_t Blocks;
+
+    _Sys_Memory_Init();
+    for(Blocks=0;Blocks<DMEM_PAGES;Blocks++)
+    {
+        Bench_Block[Blocks]=__Sys_Malloc(TID,PAGE_SIZE);
+        if(Bench_Block[Blocks]==0)
+            break;
+    }
+
+    for(Block_Cnt=0;Block_Cnt<Blocks;Block_Cnt++)
+    {
+        if((Block_Cnt>=Level*2)||((Block_Cnt&0x01)!=0))
+            __Sys_Mfree(TID,Bench_Block[Block_Cnt]);
+    }
+}
+/* End Function:Bench_Fragment ***********************************************/
+
+/* Begin Function:Bench_Malloc ************************************************
+Description : Measure __Sys_Malloc and __Sys_Mfree over the fragmentation levels,
+              until the heap is too fragmented for the request to fit.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Malloc(void)
+{
+    void xdata* Ptr;
+    cnt_t Level;
+    tid_t TID;
+    u32 Cycles;
+
+    TID=Sys_Get_TID();
+    for(Level=0;Level<DMEM_PAGES/2;Level++)
+    {
+        Bench_Fragment(TID,Level);
+
+        Bench_Timer_Start();
+        Ptr=__Sys_Malloc(TID,BENCH_MALLOC_PAGES*PAGE_SIZE);
+        Cycles=Bench_Timer_Stop();
+        if(Ptr==0)
+            break;
+        Bench_Print_Result("malloc",Level,Cycles);
+
+        Bench_Timer_Start();
+        __Sys_Mfree(TID,Ptr);
+        Cycles=Bench_Timer_Stop();
+        Bench_Print_Result("mfree",Level,Cycles);
+    }
+
+    _Sys_Memory_Init();
+}
+/* End Function:Bench_Malloc *************************************************/
+
+/* Begin Function:Bench_Memset_Byte *******************************************
+Description : Fill xdata one byte per loop pass, as Sys_Memset used to, to 
+              compare the memory primitives against.
+Input       : u8 xdata* Dst - The area.
+              u8 Char - The byte to fill with.
+              size_t Size - The size of the area.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Memset_Byte(u8 xdata* Dst,u8 Char,size_t Size)
+{
+    size_t Byte_Cnt;
+
+    for(Byte_Cnt=Size;Byte_Cnt>0;Byte_Cnt--)
+        *Dst++=Char;
+}
+/* End Function:Bench_Memset_Byte ********************************************/
+
+/* Begin Function:Bench_Mem ***************************************************
+Description : Measure the xdata fill and copy on blocks of 16 bytes up to 
+              BENCH_MEM_BYTES, with the one-byte loop as the reference.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Bench_Mem(void)
+{
+    size_t Size;
+
+    for(Size=16;Size<=BENCH_MEM_BYTES;Size<<=2)
+    {
+        Bench_Timer_Start();
+        Bench_Memset_Byte(Bench_Buf[0],0x55,Size);
+        Bench_Print_Result("memset_byte",Size,Bench_Timer_Stop());
+
+        Bench_Timer_Start();
+        Sys_Memset_Xdata(Bench_Buf[0],0xAA,Size);
+        Bench_Print_Result("memset",Size,Bench_Timer_Stop());
+
+        Bench_Timer_Start();
+        Sys_Memcpy_Xdata(Bench_Buf[1],Bench_Buf[0],Size);
+        Bench_Print_Result("memcpy",Size,Bench_Timer_Stop());
+    }
+}
+/* End Function:Bench_Mem ****************************************************/
+
+/* Begin Function:Task1 *******************************************************
+Description : The benchmark driver thread, loaded by _Sys_Init_Initial.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Task1(void)
+{
+    Bench_Init();
+    Bench_Signal();
+    Bench_Malloc();
+    Bench_Mem();
+    Bench_Switch_To();
+    /* This one leaves extra threads behind, so it goes last */
+    Bench_Switch();
+    Bench_Print_Str("# done\n");
+
+    while(1);
+}
+/* End Function:Task1 ********************************************************/
+
+/* Begin Function:Task2 *******************************************************
+Description : A thread that does nothing but yield.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Task2(void)
+{
+    while(1)
+        Sys_Switch_Now();
+}
+/* End Function:Task2 ********************************************************/
+
+/* Begin Function:Task3 *******************************************************
+Description : The handoff partner of the Sys_Switch_To benchmark.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Task3(void)
+{
+    while(1)
+        Sys_Switch_To(Bench_Driver);
+}
+/* End Function:Task3 ********************************************************/
+
+/* End Of File ***************************************************************/
+
+/* Copyright (C) 2011-2013 Evo-Devo Instrum. All rights reserved *************/
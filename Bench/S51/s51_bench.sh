@@ -0,0 +1,72 @@
+#!/bin/sh
+###############################################################################
+# Filename    : s51_bench.sh
+# Author      : pry
+# Date        : 16/10/2026
+# Description : Build kernel.c with the cycle benchmark application for the
+#               8051 using SDCC, run it on the s51 simulator of ucsim, and
+#               collect the CSV results printed on the simulated serial port.
+#               Usage: s51_bench.sh <output.csv> [baseline.csv]
+#               If a baseline is given, any result that takes more cycles
+#               than in the baseline is reported and the script fails, so a
+#               release can be checked against the previous one.
+#               MCS51_INC must point at the directory holding the MCS51_*.h
+#               board headers that sysconfig.h includes.
+###############################################################################
+
+set -e
+
+OUTPUT=$1
+BASELINE=$2
+if [ -z "$OUTPUT" ]; then
+    echo "usage: $0 <output.csv> [baseline.csv]" >&2
+    exit 2
+fi
+if [ -z "$MCS51_INC" ]; then
+    echo "MCS51_INC is not set" >&2
+    exit 2
+fi
+
+# The simulated clock must match the baud rate setup in Bench_Init
+XTAL=11059200
+# Give up if the benchmark has not finished after this many seconds
+TIMEOUT=120
+
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Build. The large model keeps the kernel variables in xdata, as declared.
+CFLAGS="-mmcs51 --model-large -I$ROOT/Include -I$MCS51_INC"
+sdcc $CFLAGS -c "$ROOT/kernel.c" -o "$WORK/kernel.rel"
+sdcc $CFLAGS -c "$ROOT/Bench/S51/S51_bench.c" -o "$WORK/S51_bench.rel"
+sdcc $CFLAGS "$WORK/kernel.rel" "$WORK/S51_bench.rel" -o "$WORK/bench.ihx"
+
+# Run until the benchmark prints its last line
+: > "$WORK/serial.txt"
+echo "run" | s51 -t 8052 -X $XTAL -S "in=/dev/null,out=$WORK/serial.txt" \
+    "$WORK/bench.ihx" > "$WORK/s51.log" 2>&1 &
+SIM=$!
+ELAPSED=0
+while ! grep -q "^# done" "$WORK/serial.txt"; do
+    if [ $ELAPSED -ge $TIMEOUT ]; then
+        kill $SIM
+        echo "benchmark did not finish in $TIMEOUT seconds" >&2
+        exit 1
+    fi
+    sleep 1
+    ELAPSED=$((ELAPSED+1))
+done
+kill $SIM 2>/dev/null || true
+
+grep -v "^#" "$WORK/serial.txt" > "$OUTPUT"
+
+# Compare against the baseline, if any
+if [ -n "$BASELINE" ]; then
+    awk -F, 'NR==FNR { if(FNR>1) base[$1","$2]=$3; next }
+             FNR>1 && ($1","$2) in base && $3>base[$1","$2] {
+                 printf "regression %s,%s: %d -> %d cycles\n",$1,$2,base[$1","$2],$3
+                 bad=1
+             }
+             END { exit bad }' "$BASELINE" "$OUTPUT"
+fi
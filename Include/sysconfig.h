@@ -6,12 +6,27 @@ Description : The Configuration Of The Operating System Is Logged Here.
               These "#define"s Are Not Included In The "defines.h".
 ******************************************************************************/
 
+/* Port Selection ************************************************************/
+/* The target port. The MCS51 port is the default; the POSIX host port can be
+ * selected from the compiler command line with "-DSYS_PORT=SYS_PORT_POSIX".
+ */
+#define SYS_PORT_MCS51              0
+#define SYS_PORT_POSIX              1
+#ifndef SYS_PORT
+#define SYS_PORT                    SYS_PORT_MCS51
+#endif
+/* End Port Selection ********************************************************/
+
 /* Includes ******************************************************************/
+#if(SYS_PORT==SYS_PORT_MCS51)
 #include "MCS51_registers.h"
 #include "MCS51_ints.h"
 #include "MCS51_typedefs.h"
 #include "MCS51_defines.h"
 #include "MCS51_externs.h"
+#else
+#include "POSIX_port.h"
+#endif
 /* End Includes **************************************************************/
 
 /* Preprocessor Control ******************************************************/
@@ -29,21 +44,140 @@ Description : The Configuration Of The Operating System Is Logged Here.
 /* End Basic Configuration ***************************************************/                                                     
 
 /* Kernel Configuration ******************************************************/
-/* Stacks */
+/* Stacks. Each thread stack starts with the 2-byte address it returns to when
+ * the thread function returns, below the first frame of the function.
+ */
 #define KERNEL_STACK_SIZE           30
 #define APP_STACK_1_SIZE            10
 #define APP_STACK_2_SIZE            10
 
+/* Stack checking - paint each thread stack when the thread is loaded, so that
+ * Sys_Get_Stack_Used can tell the most it has used. Each Thread_Init_Struct 
+ * then needs the Stack_Size. ENABLE_STACK_GUARD also checks the stack of each
+ * thread switched out, and kills it if it has used all of it.
+ */
+#define ENABLE_STACK_CHECK          FALSE
+#define ENABLE_STACK_GUARD          FALSE
+
+/* Stack copying - all threads run on one idata stack of SHARED_STACK_SIZE, and
+ * each switch copies the live part of it to and from a STACK_COPY_SIZE save 
+ * area in xdata for each thread. The Init_SP of the threads is then ignored.
+ * STACK_COPY_SIZE must cover the deepest point where a thread can switch out,
+ * the interrupt frame included when preempting. A thread that switches out 
+ * deeper is killed, and its TID is left in Sys_Stack_Fault_TID.
+ */
+#define ENABLE_STACK_COPY           FALSE
+#define SHARED_STACK_SIZE           64
+#define STACK_COPY_SIZE             24
+
 /* Threads/Tasks */
 #define MAX_THREADS                 3                 
 #define MAX_STACK_DEP               10                         
+/* Hot TCB fields - the status, the pending signals and the saved stack pointer
+ * of each thread are read on every switch, so they are kept in arrays apart
+ * from the TCB. They are in xdata, or in idata if this is TRUE, which is faster
+ * but takes 4 or 5 bytes of idata per thread.
+ */
+#define ENABLE_TCB_HOT              FALSE
+/* Static thread table - the application defines Sys_Thread_Table in code memory
+ * with STATIC_THREADS entries, and they are loaded as TID 1 onwards while the
+ * scheduler is set up, instead of Task1 from _Sys_Init_Initial.
+ */
+#define ENABLE_THREAD_TABLE         FALSE
+#define STATIC_THREADS              1
+/* Join - a thread may wait in Sys_Thread_Join for another to end, and is given
+ * what it passed to Sys_Thread_Exit, or THREAD_KILLED.
+ */
+#define ENABLE_JOIN                 FALSE
+
+/* Priority - when enabled, the scheduler always runs the highest priority ready
+ * thread, round-robin among threads of the same priority. At most 8 levels;
+ * 0 is the lowest, and is where the "Init" thread runs.
+ */
+#define ENABLE_PRIORITY             FALSE
+#define MAX_PRIORITY                8
+
+/* System tick - needs the Timer 2 of the 8052. TICK_RELOAD is the auto-reload
+ * value; 0xDC00 is a 10ms tick at 11.0592MHz.
+ */
+#define ENABLE_TICK                 FALSE
+#define TICK_RELOAD                 0xDC00
+/* Preemption - needs the system tick. A thread is switched out after running 
+ * PREEMPT_SLICE_TICKS ticks. Each thread stack, including the kernel stack, 
+ * then needs 13 more bytes for the register context.
+ */
+#define ENABLE_PREEMPT              FALSE
+#define PREEMPT_SLICE_TICKS         2
+/* Idle mode - when no thread but "Init" is ready, "Init" puts the CPU in the 
+ * idle mode of PCON until an interrupt comes. The time spent idle, and the 
+ * longest time from a wakeup to a thread running, are counted with the Timer 0,
+ * as the profiler does; an idle stretch longer than 65536 cycles is counted 
+ * short, so run the tick faster than that.
+ */
+#define ENABLE_IDLE                 FALSE
+
+/* Signals - the number of user signals, at most 16. With ENABLE_SIGNAL_COUNT,
+ * each send of a user signal runs its handler once, even when several sends
+ * come before the thread is switched to.
+ */
+#define USER_SIGNALS                4
+#define ENABLE_SIGNAL_COUNT         FALSE
+/* Sends from interrupts - they go through a ring of ISR_RING_SIZE entries, a 
+ * power of 2 not above 128, which is emptied at each context switch. Only the
+ * interrupts of one priority level may use it, as they cannot nest.
+ */
+#define ENABLE_ISR_POST             FALSE
+#define ISR_RING_SIZE               8
+
+/* Mailboxes - pass pointers to Sys_Malloc'd buffers between threads. Needs the
+ * memory management, because each mailbox keeps its slots in the heap.
+ */
+#define ENABLE_MBOX                 FALSE
+/* Mutexes and counting semaphores */
+#define ENABLE_SYNC                 FALSE
+/* Event flag groups */
+#define ENABLE_EVENT                FALSE
+
+/* Interrupt-off time profiler - times each outermost Sys_Lock_Interrupt to its
+ * Sys_Unlock_Interrupt. On the 8051 it takes the Timer 0 as a free-running 
+ * cycle counter, so sections longer than 65535 cycles wrap. The histogram has
+ * INT_PROF_BINS bins; bin N counts the sections of 2^N to 2^(N+1)-1 cycles.
+ */
+#define ENABLE_INT_PROF             FALSE
+#define INT_PROF_BINS               16
+
+/* Scheduler trace - the switches, signals, kills and allocations are recorded
+ * with a timestamp in Sys_Trace, a ring of TRACE_SIZE records, and the run time
+ * of each thread is summed up. Dump Sys_Trace and decode it with Tools/Trace.
+ * The 8051 takes the Timer 0 for the time, as the profiler does, and counts 
+ * its wraps; something has to be traced, or the tick must run, at least once 
+ * every 65536 cycles. TRACE_SIZE is a power of 2, at most 128.
+ */
+#define ENABLE_TRACE                FALSE
+#define TRACE_SIZE                  32
 /* End Kernel Configuration **************************************************/
 
+/* Port Configuration ********************************************************/
+/* The host stack size of each thread, in bytes. Only used by the POSIX port */
+#define POSIX_STACK_SIZE            65536
+/* The host tick period, in microseconds. Only used by the POSIX port */
+#define POSIX_TICK_US               1000
+/* End Port Configuration ****************************************************/
+
 /* Memory Management Configuration *******************************************/
 /* Memory */
 #define ENABLE_MEMM      	        TRUE
 #define DMEM_SIZE			        800
 #define DMEM_PAGES                  40
+/* Fixed-size block pools, carved from the heap above */
+#define ENABLE_MEM_POOL             FALSE
+/* Movable blocks reached through handles, and heap compaction. MEM_HANDLES is
+ * the size of the handle table; MEM_COMPACT_BUDGET is about how many bytes the
+ * "Init" thread moves each time it runs.
+ */
+#define ENABLE_MEM_HANDLE           FALSE
+#define MEM_HANDLES                 8
+#define MEM_COMPACT_BUDGET          64
 /* End Memory Manegement Configuration ***************************************/
 
 /* _SYSCONFIG_H_ */
@@ -0,0 +1,190 @@
+/******************************************************************************
+Filename    : POSIX_bench.c
+Author      : pry
+Date        : 16/10/2026
+Description : The host benchmark application for the POSIX port. It measures
+              the cost of Sys_Switch_Now and of the paged memory allocator, 
+              and prints one "name value unit" line per result.
+              Build and run from the repository root with:
+              cc -O2 -DSYS_PORT=SYS_PORT_POSIX -IInclude -IPort/POSIX kernel.c
+                 Port/POSIX/POSIX_port.c Port/POSIX/POSIX_bench.c -o rmv_bench
+              ./rmv_bench
+******************************************************************************/
+
+/* Includes ******************************************************************/
+/* System headers go first, see POSIX_port.h */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sysconfig.h"
+#include "KERNEL.H"
+/* End Includes **************************************************************/
+
+/* Defines *******************************************************************/
+/* How many rounds each benchmark runs */
+#define BENCH_SWITCH_ROUNDS         1000000
+#define BENCH_MALLOC_ROUNDS         1000000
+/* How many allocations the churn benchmark keeps alive at most */
+#define BENCH_MALLOC_SLOTS          8
+/* End Defines ***************************************************************/
+
+/* Begin Function:Bench_Get_Time_NS *******************************************
+Description : Read the host monotonic clock.
+Input       : None.
+Output      : None.
+Return      : double - The time in nanoseconds.
+******************************************************************************/
+static double Bench_Get_Time_NS(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC,&Now);
+    return Now.tv_sec*1e9+Now.tv_nsec;
+}
+/* End Function:Bench_Get_Time_NS ********************************************/
+
+/* Begin Function:Bench_Switch ************************************************
+Description : Measure the round-robin context switch. Every thread in the system
+              is ready and yields at once, so each loop here is a full lap of
+              MAX_THREADS switches.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void Bench_Switch(void)
+{
+    cnt_t Thread_Cnt;
+    u32 Round_Cnt;
+    double Start;
+    double End;
+
+    /* Count the ready threads */
+    Thread_Cnt=0;
+    while(Thread_Cnt<MAX_THREADS)
+    {
+        if((TCB_Status[Thread_Cnt]&READY)==0)
+            break;
+        Thread_Cnt++;
+    }
+
+    Start=Bench_Get_Time_NS();
+    for(Round_Cnt=0;Round_Cnt<BENCH_SWITCH_ROUNDS;Round_Cnt++)
+        Sys_Switch_Now();
+    End=Bench_Get_Time_NS();
+
+    printf("switch_ready_threads %u threads\n",(unsigned)Thread_Cnt);
+    printf("switch_ns %.1f ns\n",(End-Start)/BENCH_SWITCH_ROUNDS/Thread_Cnt);
+}
+/* End Function:Bench_Switch *************************************************/
+
+/* Begin Function:Bench_Malloc ************************************************
+Description : Measure __Sys_Malloc and __Sys_Mfree under random churn, which 
+              fragments Mem.Mem_CB the way long-running applications do.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void Bench_Malloc(void)
+{
+    void xdata* Slot[BENCH_MALLOC_SLOTS]={0};
+    u32 Round_Cnt;
+    u32 Fail_Cnt;
+    cnt_t Slot_Cnt;
+    double Start;
+    double End;
+
+    srand(1);
+    Fail_Cnt=0;
+    Start=Bench_Get_Time_NS();
+    for(Round_Cnt=0;Round_Cnt<BENCH_MALLOC_ROUNDS;Round_Cnt++)
+    {
+        Slot_Cnt=rand()%BENCH_MALLOC_SLOTS;
+        if(Slot[Slot_Cnt]!=0)
+        {
+            Sys_Mfree(Slot[Slot_Cnt]);
+            Slot[Slot_Cnt]=0;
+        }
+        else
+        {
+            Slot[Slot_Cnt]=Sys_Malloc(1+rand()%(DMEM_SIZE/BENCH_MALLOC_SLOTS));
+            if(Slot[Slot_Cnt]==0)
+                Fail_Cnt++;
+        }
+    }
+    End=Bench_Get_Time_NS();
+    Sys_Mfree_All();
+
+    printf("malloc_churn_ns %.1f ns\n",(End-Start)/BENCH_MALLOC_ROUNDS);
+    printf("malloc_churn_failures %lu count\n",(unsigned long)Fail_Cnt);
+}
+/* End Function:Bench_Malloc *************************************************/
+
+/* Begin Function:Task1 *******************************************************
+Description : The benchmark driver thread, loaded by _Sys_Init_Initial. Starts
+              the other threads, runs the benchmarks and exits the process.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Task1(void)
+{
+    struct Thread_Init_Struct Thread;
+    tid_t TID;
+
+    /* Fill the remaining slots with threads that only yield */
+    while(1)
+    {
+        Thread.TID=AUTO_PID;
+        Thread.Thread_Name="Yield";
+        Thread.Init_SP=0;
+        Thread.Entrance=(ptr_int_t)Task2;
+#if(ENABLE_STACK_CHECK==TRUE)
+        /* The port always uses its own POSIX_STACK_SIZE host stacks */
+        Thread.Stack_Size=0;
+#endif
+#if(ENABLE_PRIORITY==TRUE)
+        /* Same priority as this thread, so that they take turns */
+        Thread.Prio=TCB[Sys_Get_TID()].Prio;
+#endif
+        TID=Sys_Start_Thread(&Thread);
+        if(TID<0)
+            break;
+        Sys_Set_Ready(TID);
+    }
+
+    Bench_Switch();
+    Bench_Malloc();
+    exit(0);
+}
+/* End Function:Task1 ********************************************************/
+
+/* Begin Function:Task2 *******************************************************
+Description : A thread that does nothing but yield.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Task2(void)
+{
+    while(1)
+        Sys_Switch_Now();
+}
+/* End Function:Task2 ********************************************************/
+
+/* Begin Function:Task3 *******************************************************
+Description : Unused by the benchmark.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Task3(void)
+{
+    while(1)
+        Sys_Switch_Now();
+}
+/* End Function:Task3 ********************************************************/
+
+/* End Of File ***************************************************************/
+
+/* Copyright (C) 2011-2013 Evo-Devo Instrum. All rights reserved *************/
@@ -0,0 +1,238 @@
+/******************************************************************************
+Filename    : POSIX_mbox_test.c
+Author      : pry
+Date        : 16/10/2026
+Description : The host test of mailbox buffer ownership for the POSIX port. A
+              mailbox and the messages sent to it must outlive the threads that
+              made them: the creator and the producers here exit before anything
+              is received. Only the creator can delete a mailbox, or anyone
+              once the creator has exited. It prints one line per check, and exits with 0 if all
+              of them pass. It needs ENABLE_MBOX in sysconfig.h.
+              Build and run from the repository root with:
+              cc -O2 -DSYS_PORT=SYS_PORT_POSIX -IInclude -IPort/POSIX kernel.c
+                 Port/POSIX/POSIX_port.c Port/POSIX/POSIX_mbox_test.c -o rmv_mbox
+              ./rmv_mbox
+******************************************************************************/
+
+/* Includes ******************************************************************/
+/* System headers go first, see POSIX_port.h */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sysconfig.h"
+#include "KERNEL.H"
+/* End Includes **************************************************************/
+
+/* Defines *******************************************************************/
+#if(ENABLE_MBOX==FALSE)
+#error "The mailbox test needs ENABLE_MBOX."
+#endif
+/* The size of each message buffer, and what the producer fills it with */
+#define TEST_MSG_SIZE               (PAGE_SIZE*2)
+#define TEST_MSG_FILL               0x5A
+/* The mailbox slots */
+#define TEST_MBOX_SLOTS             2
+/* End Defines ***************************************************************/
+
+/* Global Variables **********************************************************/
+/* The mailbox, created by a thread that exits at once */
+struct Mailbox Test_Mbox;
+/* The mailbox of a thread that waits on it until it is sent a message */
+struct Mailbox Test_Mbox_Held;
+/* How many checks failed */
+cnt_t Test_Fail;
+/* End Global Variables ******************************************************/
+
+/* Begin Function:Test_Check **************************************************
+Description : Print the result of a check, and count it if it failed.
+Input       : int Pass - Whether the check passed.
+              const char* Name - What was checked.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void Test_Check(int Pass,const char* Name)
+{
+    printf("%s %s\n",Pass?"pass":"FAIL",Name);
+    if(Pass==0)
+        Test_Fail++;
+}
+/* End Function:Test_Check ***************************************************/
+
+/* Begin Function:Test_Owner **************************************************
+Description : Find who owns a block from the heap.
+Input       : void xdata* Mem_Ptr - The start of the block.
+Output      : None.
+Return      : tid_t - The owner TID, or MEM_KERNEL.
+******************************************************************************/
+static tid_t Test_Owner(void xdata* Mem_Ptr)
+{
+    return Mem.Mem_CB[((u8 xdata*)Mem_Ptr-Mem.DMEM_Heap)/PAGE_SIZE];
+}
+/* End Function:Test_Owner ***************************************************/
+
+/* Begin Function:Test_Start **************************************************
+Description : Start a thread at the priority of the current one.
+Input       : void (*Entrance)(void) - The thread function.
+              u8 Wait - If 1, wait until the thread has exited; else return at
+                        once.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void Test_Start(void (*Entrance)(void),u8 Wait)
+{
+    struct Thread_Init_Struct Thread;
+    tid_t TID;
+
+    Thread.TID=AUTO_PID;
+    Thread.Thread_Name="Test";
+    Thread.Init_SP=0;
+    Thread.Entrance=(ptr_int_t)Entrance;
+#if(ENABLE_STACK_CHECK==TRUE)
+    /* The port always uses its own POSIX_STACK_SIZE host stacks */
+    Thread.Stack_Size=0;
+#endif
+#if(ENABLE_PRIORITY==TRUE)
+    Thread.Prio=TCB[Sys_Get_TID()].Prio;
+#endif
+    TID=Sys_Start_Thread(&Thread);
+    if(TID<0)
+    {
+        printf("FAIL can't start a thread, see MAX_THREADS\n");
+        exit(1);
+    }
+    Sys_Set_Ready(TID);
+
+    while((Wait!=0)&&((TCB_Status[TID]&OCCUPY)!=0))
+        Sys_Switch_Now();
+}
+/* End Function:Test_Start ***************************************************/
+
+/* Begin Function:Test_Check_Msg **********************************************
+Description : Check a received message: it must be the receiver's, with what the
+              producer wrote intact after the heap has been used again.
+Input       : void xdata* Msg - The message.
+              const char* Name - Which case this is.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void Test_Check_Msg(void xdata* Msg,const char* Name)
+{
+    u8 xdata* Other;
+    cnt_t Byte_Cnt;
+    int Intact;
+
+    printf("# %s\n",Name);
+    Test_Check(Msg!=0,"message received");
+    if(Msg==0)
+        return;
+    Test_Check(Test_Owner(Msg)==Sys_Get_TID(),"message owned by the receiver");
+
+    /* Had the buffer gone back to the heap, this would take its place */
+    Other=(u8 xdata*)Sys_Malloc(TEST_MSG_SIZE);
+    Sys_Memset_Xdata(Other,0,TEST_MSG_SIZE);
+    Intact=1;
+    for(Byte_Cnt=0;Byte_Cnt<TEST_MSG_SIZE;Byte_Cnt++)
+    {
+        if(((u8 xdata*)Msg)[Byte_Cnt]!=TEST_MSG_FILL)
+            Intact=0;
+    }
+    Test_Check(Intact,"message intact");
+
+    Sys_Mfree(Other);
+    Sys_Mfree(Msg);
+    Test_Check(Mem.Mem_Block_Head[Sys_Get_TID()]==MEM_NIL,"receiver can free it");
+}
+/* End Function:Test_Check_Msg ***********************************************/
+
+/* Begin Function:Test_Holder ************************************************
+Description : Create a mailbox, wait for one message on it, and exit.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void Test_Holder(void)
+{
+    Sys_Mbox_Create(&Test_Mbox_Held,TEST_MBOX_SLOTS);
+    Sys_Mbox_Recv(&Test_Mbox_Held);
+}
+/* End Function:Test_Holder **************************************************/
+
+/* Begin Function:Task1 *******************************************************
+Description : The test driver thread, loaded by _Sys_Init_Initial.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Task1(void)
+{
+    void xdata* Msg;
+
+    /* The creator exits before the mailbox is ever used */
+    Test_Start(Task2,1);
+    Test_Check(Test_Mbox.Slot!=0,"mailbox created");
+    Test_Check(Test_Owner(Test_Mbox.Slot)==MEM_KERNEL,"slots outlive the creator");
+    Test_Check(Test_Mbox.Owner==MEM_KERNEL,"creator gone, mailbox left to anyone");
+
+    /* A message left queued by a producer that has exited */
+    Test_Start(Task3,1);
+    Test_Check(Test_Mbox.Msg_Num==1,"message queued");
+    Test_Check(Test_Owner(Test_Mbox.Slot[Test_Mbox.Head])==MEM_KERNEL,
+               "queued message held by the mailbox");
+    Test_Check_Msg(Sys_Mbox_Try_Recv(&Test_Mbox),"queued, producer exited");
+
+    /* A message handed to a waiting receiver by a producer that then exits */
+    Test_Start(Task3,0);
+    Msg=Sys_Mbox_Recv(&Test_Mbox);
+    Test_Check_Msg(Msg,"handed over, producer exited");
+
+    /* A mailbox whose creator is alive is only the creator's to delete */
+    printf("# deleting\n");
+    Test_Start(Test_Holder,0);
+    Sys_Switch_Now();
+    Test_Check(Sys_Mbox_Delete(&Test_Mbox_Held)!=0,"creator alive, delete refused");
+    Sys_Mbox_Send(&Test_Mbox_Held,Sys_Malloc(TEST_MSG_SIZE));
+    while(Test_Mbox_Held.Owner!=MEM_KERNEL)
+        Sys_Switch_Now();
+    Test_Check(Sys_Mbox_Delete(&Test_Mbox_Held)==0,"creator gone, delete allowed");
+    Test_Check(Sys_Mbox_Delete(&Test_Mbox)==0,"first mailbox deleted");
+    Test_Check(Mem.Mem_Block_Head[MEM_KERNEL]==MEM_NIL,"all slots freed");
+    Test_Check(Mbox_List==0,"no mailboxes left");
+
+    printf("%s\n",(Test_Fail==0)?"# all passed":"# some FAILED");
+    exit((Test_Fail==0)?0:1);
+}
+/* End Function:Task1 ********************************************************/
+
+/* Begin Function:Task2 *******************************************************
+Description : Create the mailbox, and exit.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Task2(void)
+{
+    Sys_Mbox_Create(&Test_Mbox,TEST_MBOX_SLOTS);
+}
+/* End Function:Task2 ********************************************************/
+
+/* Begin Function:Task3 *******************************************************
+Description : Send one message in a fresh buffer, and exit.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Task3(void)
+{
+    void xdata* Msg;
+
+    Msg=Sys_Malloc(TEST_MSG_SIZE);
+    if(Msg==0)
+        return;
+    Sys_Memset_Xdata(Msg,TEST_MSG_FILL,TEST_MSG_SIZE);
+    Sys_Mbox_Send(&Test_Mbox,Msg);
+}
+/* End Function:Task3 ********************************************************/
+
+/* End Of File ***************************************************************/
+
+/* Copyright (C) 2011-2013 Evo-Devo Instrum. All rights reserved *************/
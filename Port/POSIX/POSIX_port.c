@@ -0,0 +1,272 @@
+/******************************************************************************
+Filename    : POSIX_port.c
+Author      : pry
+Date        : 16/10/2026
+Description : The POSIX host port of the RTOS-MV. Implements the functions that
+              are written against the 8051 hardware in kernel.c: the global
+              interrupt switch, the stack pointer save/load and the initial
+              thread stack frame.
+******************************************************************************/
+
+/* Includes ******************************************************************/
+/* System headers go first, see POSIX_port.h */
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+/* The kernel reuses some of these names for its own signals */
+#undef SIGKILL
+#undef SIGUSR1
+#undef SIGUSR2
+
+#include "sysconfig.h"
+#include "KERNEL.H"
+/* End Includes **************************************************************/
+
+/* Global Variables **********************************************************/
+/* The thread that Sys_Switch_Now is switching away from */
+volatile s8 _Sys_Port_Save_TID;
+/* The saved contexts and the host stacks of all threads */
+static ucontext_t _Sys_Port_Context[MAX_THREADS];
+static u8 _Sys_Port_Stack[MAX_THREADS][POSIX_STACK_SIZE];
+/* End Global Variables ******************************************************/
+
+/* Begin Function:DISABLE_ALL_INTS ********************************************
+Description : Disable all interrupts. On the host, this blocks all signals.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void DISABLE_ALL_INTS(void)
+{
+    sigset_t Mask;
+
+    sigfillset(&Mask);
+    sigprocmask(SIG_SETMASK,&Mask,0);
+}
+/* End Function:DISABLE_ALL_INTS *********************************************/
+
+/* Begin Function:ENABLE_ALL_INTS *********************************************
+Description : Enable all interrupts. On the host, this unblocks all signals.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void ENABLE_ALL_INTS(void)
+{
+    sigset_t Mask;
+
+    sigemptyset(&Mask);
+    sigprocmask(SIG_SETMASK,&Mask,0);
+}
+/* End Function:ENABLE_ALL_INTS **********************************************/
+
+/* Begin Function:_Sys_Prof_Time **********************************************
+Description : Read the free-running time for the interrupt-off profiler.
+Input       : None.
+Output      : None.
+Return      : prof_t - The host monotonic clock, in nanoseconds, wrapping.
+******************************************************************************/
+#if((ENABLE_INT_PROF==TRUE)||(ENABLE_TRACE==TRUE)||(ENABLE_IDLE==TRUE))
+prof_t _Sys_Prof_Time(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC,&Now);
+    return (prof_t)(Now.tv_sec*1000000000ULL+Now.tv_nsec);
+}
+#endif
+/* End Function:_Sys_Prof_Time ***********************************************/
+
+/* Begin Function:_Sys_Trace_Time *********************************************
+Description : Read the time for the trace.
+Input       : None.
+Output      : None.
+Return      : u32 - The host monotonic clock, in microseconds, wrapping.
+******************************************************************************/
+#if(ENABLE_TRACE==TRUE)
+u32 _Sys_Trace_Time(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC,&Now);
+    return (u32)(Now.tv_sec*1000000ULL+Now.tv_nsec/1000);
+}
+#endif
+/* End Function:_Sys_Trace_Time **********************************************/
+
+/* Begin Function:_Sys_Port_Thread_Entry **************************************
+Description : The first code a new thread runs. On the 8051 a new thread starts
+              by returning from Sys_Switch_Now, which unlocks the interrupt on
+              the way out; a fresh ucontext_t skips that, so do it here.
+Input       : int TID - The thread ID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void _Sys_Port_Thread_Entry(int TID)
+{
+    Sys_Unlock_Interrupt();
+    ((void(*)(void))TCB[TID].Entrance)();
+
+    /* A thread function that returns exits with 0 */
+    Sys_Thread_Exit(0);
+}
+/* End Function:_Sys_Port_Thread_Entry ***************************************/
+
+/* Begin Function:_Sys_Thread_Stack_Init **************************************
+Description : Initialize a thread's stack given the TID. The host ignores the
+              8051 stack in TCB_SP_Now and runs the thread on a host stack.
+Input       : tid_t TID - The thread's TID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Thread_Stack_Init(tid_t TID)
+{
+    getcontext(&_Sys_Port_Context[TID]);
+    _Sys_Port_Context[TID].uc_stack.ss_sp=_Sys_Port_Stack[TID];
+    _Sys_Port_Context[TID].uc_stack.ss_size=POSIX_STACK_SIZE;
+    _Sys_Port_Context[TID].uc_link=0;
+    /* The thread starts inside Sys_Switch_Now, where the interrupts are off */
+    sigfillset(&_Sys_Port_Context[TID].uc_sigmask);
+    makecontext(&_Sys_Port_Context[TID],(void(*)(void))_Sys_Port_Thread_Entry,1,(int)TID);
+}
+/* End Function:_Sys_Thread_Stack_Init ***************************************/
+
+/* Begin Function:_Sys_Stack_Paint ********************************************
+Description : Paint the host stack of a thread with STACK_PAINT. The host stacks
+              are all POSIX_STACK_SIZE, whatever the thread was given. "Init"
+              runs on the process stack, so its painted stack stays unused.
+Input       : tid_t TID - The thread's TID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_STACK_CHECK==TRUE)
+void _Sys_Stack_Paint(tid_t TID)
+{
+    memset(_Sys_Port_Stack[TID],STACK_PAINT,POSIX_STACK_SIZE);
+}
+#endif
+/* End Function:_Sys_Stack_Paint *********************************************/
+
+/* Begin Function:_Sys_Stack_Used *********************************************
+Description : Find out how much of its host stack a thread has used at most. The
+              host stack grows downwards, so this is down to the lowest byte that
+              is no longer painted.
+Input       : tid_t TID - The thread's TID.
+Output      : None.
+Return      : cnt_t - The most bytes used.
+******************************************************************************/
+#if(ENABLE_STACK_CHECK==TRUE)
+cnt_t _Sys_Stack_Used(tid_t TID)
+{
+    size_t Free=0;
+    
+    while((Free<POSIX_STACK_SIZE)&&(_Sys_Port_Stack[TID][Free]==STACK_PAINT))
+        Free++;
+    /* cnt_t is 16 bits, and the host stacks may be bigger */
+    if((POSIX_STACK_SIZE-Free)>0xFFFF)
+        return 0xFFFF;
+    return (cnt_t)(POSIX_STACK_SIZE-Free);
+}
+#endif
+/* End Function:_Sys_Stack_Used **********************************************/
+
+/* Begin Function:_Sys_Stack_Overflow *****************************************
+Description : See if a thread has overflowed its host stack, that is, the lowest
+              byte is no longer painted.
+Input       : tid_t TID - The thread's TID.
+Output      : None.
+Return      : u8 - If overflowed, 1; else 0.
+******************************************************************************/
+#if(ENABLE_STACK_CHECK==TRUE)
+u8 _Sys_Stack_Overflow(tid_t TID)
+{
+    return (_Sys_Port_Stack[TID][0]!=STACK_PAINT);
+}
+#endif
+/* End Function:_Sys_Stack_Overflow ******************************************/
+
+/* Begin Function:_Sys_Port_Switch ********************************************
+Description : Switch from the thread recorded by SYS_SAVE_SP to Current_TID.
+              The saved context of the outgoing thread is resumed inside this
+              function, when some later switch picks it again.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Port_Switch(void)
+{
+    tid_t Save_TID=_Sys_Port_Save_TID;
+
+    if(Save_TID==Current_TID)
+        return;
+
+    _Sys_Port_Save_TID=Current_TID;
+    swapcontext(&_Sys_Port_Context[Save_TID],&_Sys_Port_Context[Current_TID]);
+}
+/* End Function:_Sys_Port_Switch *********************************************/
+
+/* Begin Function:_Sys_Port_Tick_Signal ***************************************
+Description : The SIGALRM handler, which stands for the tick interrupt. It runs
+              with all signals blocked, like an interrupt with the others off.
+Input       : int Signal - The signal number.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_TICK==TRUE)
+static void _Sys_Port_Tick_Signal(int Signal)
+{
+    _Sys_Tick_Handler();
+}
+#endif
+/* End Function:_Sys_Port_Tick_Signal ****************************************/
+
+/* Begin Function:_Sys_Port_Tick_Init *****************************************
+Description : Start an interval timer that raises SIGALRM every POSIX_TICK_US.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_TICK==TRUE)
+void _Sys_Port_Tick_Init(void)
+{
+    struct sigaction Action;
+    struct itimerval Timer;
+
+    Action.sa_handler=_Sys_Port_Tick_Signal;
+    sigfillset(&Action.sa_mask);
+    Action.sa_flags=SA_RESTART;
+    sigaction(SIGALRM,&Action,0);
+
+    Timer.it_interval.tv_sec=0;
+    Timer.it_interval.tv_usec=POSIX_TICK_US;
+    Timer.it_value=Timer.it_interval;
+    setitimer(ITIMER_REAL,&Timer,0);
+}
+#endif
+/* End Function:_Sys_Port_Tick_Init ******************************************/
+
+/* Begin Function:_Sys_Port_Idle **********************************************
+Description : Unblock all signals and wait for one, which stands for the idle 
+              mode. sigsuspend does both at once, as SETB EA and the write to 
+              PCON do on the 8051. Returns with the signals unblocked.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_IDLE==TRUE)
+void _Sys_Port_Idle(void)
+{
+    sigset_t Mask;
+
+    sigemptyset(&Mask);
+    sigsuspend(&Mask);
+    ENABLE_ALL_INTS();
+}
+#endif
+/* End Function:_Sys_Port_Idle ***********************************************/
+
+/* End Of File ***************************************************************/
+
+/* Copyright (C) 2011-2013 Evo-Devo Instrum. All rights reserved *************/
@@ -0,0 +1,113 @@
+/******************************************************************************
+Filename    : POSIX_port.h
+Author      : pry
+Date        : 16/10/2026
+Description : The header for the POSIX host port of the RTOS-MV. This port lets
+              the unmodified scheduler, signal and memory modules of kernel.c
+              run inside an ordinary Linux process, so that they can be profiled
+              on the host. The thread context is kept in a ucontext_t per TID,
+              and the global interrupt enable is emulated with the process
+              signal mask.
+              Build with "-DSYS_PORT=SYS_PORT_POSIX -IInclude -IPort/POSIX" and
+              link POSIX_port.c together with kernel.c.
+******************************************************************************/
+
+/* Preprocessor Control ******************************************************/
+#ifndef _POSIX_PORT_H_
+#define _POSIX_PORT_H_
+
+/* Includes ******************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+/* End Includes **************************************************************/
+
+/* Defines *******************************************************************/
+/* The 8051 memory region keywords mean nothing on the host. Include any
+ * system header before this file, as these are plain identifiers there.
+ */
+#define idata
+#define pdata
+#define xdata
+#define code
+/* End Defines ***************************************************************/
+
+/* Basic Types ***************************************************************/
+typedef int32_t  s32;
+typedef int16_t  s16;
+typedef char     s8;
+
+typedef const int32_t sc32;
+typedef const int16_t sc16;
+typedef const char    sc8;
+
+typedef volatile int32_t vs32;
+typedef volatile int16_t vs16;
+typedef volatile char    vs8;
+
+typedef volatile const int32_t vsc32;
+typedef volatile const int16_t vsc16;
+typedef volatile const char    vsc8;
+
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t  u8;
+
+typedef const uint32_t uc32;
+typedef const uint16_t uc16;
+typedef const uint8_t  uc8;
+
+typedef volatile uint32_t vu32;
+typedef volatile uint16_t vu16;
+typedef volatile uint8_t  vu8;
+
+typedef volatile const uint32_t vuc32;
+typedef volatile const uint16_t vuc16;
+typedef volatile const uint8_t  vuc8;
+
+/* The pointer's integer type - on the host, as wide as a pointer */
+typedef uintptr_t ptr_int_t;
+/* The profiler time type - on the host, nanoseconds */
+typedef uint32_t prof_t;
+/* End Basic Types ***********************************************************/
+
+/* Pseudo-Assembly Functions *************************************************/
+/* On the host the "stack pointer" is a whole ucontext_t. Saving only records
+ * which thread we are switching away from; loading does the actual swap.
+ */
+#define SYS_SAVE_SP()  _Sys_Port_Save_TID=Current_TID;
+#define SYS_LOAD_SP()  _Sys_Port_Switch()
+/* The host threads have stacks of their own, so nothing is copied */
+#define SYS_STACK_SAVE(TID)
+#define SYS_STACK_LOAD(TID)
+
+/* The tick "interrupt" is the SIGALRM of an interval timer */
+#define SYS_TICK_INTERRUPT
+#define SYS_TICK_INIT()         _Sys_Port_Tick_Init()
+#define SYS_TICK_CLEAR()
+
+/* The profiler reads the host clock, which needs no setup */
+#define SYS_PROF_INIT()
+#define SYS_PROF_CALLER()       ((ptr_int_t)__builtin_return_address(0))
+
+/* Idle waits for a signal with all of them unblocked */
+#define SYS_IDLE()              _Sys_Port_Idle()
+/* End Pseudo-Assembly Functions *********************************************/
+
+/* Global Variables **********************************************************/
+extern volatile s8 _Sys_Port_Save_TID;
+/* End Global Variables ******************************************************/
+
+/* Public Function Prototypes ************************************************/
+extern void _Sys_Port_Switch(void);
+extern void _Sys_Port_Tick_Init(void);
+extern void _Sys_Port_Idle(void);
+extern void _Sys_Tick_Handler(void);
+/* End Public Function Prototypes ********************************************/
+
+/* _POSIX_PORT_H_ */
+#endif
+/* End Preprocessor Control **************************************************/
+
+/* End Of File ***************************************************************/
+
+/* Copyright (C) 2011-2013 Evo-Devo Instrum. All rights reserved *************/
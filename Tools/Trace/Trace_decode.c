@@ -0,0 +1,252 @@
+/******************************************************************************
+Filename    : Trace_decode.c
+Author      : pry
+Date        : 16/10/2026
+Description : The host decoder of the scheduler trace. It reads a binary dump
+              of Sys_Trace, prints the records from the oldest to the newest,
+              and then how much of the traced time each thread has run.
+              The dump is the raw bytes of the struct Trace, as they are in the
+              memory of the board: the head, the wrapped flag, then TRACE_SIZE
+              records of 8 bytes. The time unit is that of the port: machine
+              cycles on the 8051, microseconds on the POSIX port.
+              Build and run with:
+              cc -O2 Tools/Trace/Trace_decode.c -o trace_decode
+              ./trace_decode trace.bin
+******************************************************************************/
+
+/* Includes ******************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+/* End Includes **************************************************************/
+
+/* Defines *******************************************************************/
+/* These must match KERNEL.H */
+#define TRACE_SWITCH                0x01
+#define TRACE_SIGNAL                0x02
+#define TRACE_KILL                  0x03
+#define TRACE_MALLOC                0x04
+#define TRACE_REC_SIZE              8
+/* The most records and threads that can be decoded */
+#define DECODE_MAX_RECS             256
+#define DECODE_MAX_THREADS          256
+/* End Defines ***************************************************************/
+
+/* Structs *******************************************************************/
+struct Decode_Rec
+{
+    uint8_t Type;
+    uint8_t TID;
+    uint8_t Arg1;
+    uint8_t Arg2;
+    /* Unwrapped to 64 bits */
+    uint64_t Time;
+};
+/* End Structs ***************************************************************/
+
+/* Global Variables **********************************************************/
+static struct Decode_Rec Rec[DECODE_MAX_RECS];
+static uint64_t Run_Time[DECODE_MAX_THREADS];
+/* End Global Variables ******************************************************/
+
+/* Begin Function:Decode_Load *************************************************
+Description : Read a dump, and put its records in time order, unwrapping the
+              32-bit time.
+Input       : const char* Path - The dump file.
+Output      : None.
+Return      : int - The number of records. If the dump can't be read, -1.
+******************************************************************************/
+static int Decode_Load(const char* Path)
+{
+    FILE* File;
+    uint8_t Buf[2+DECODE_MAX_RECS*TRACE_REC_SIZE];
+    size_t Size;
+    int Slots;
+    int Head;
+    int Count;
+    int First;
+    int Rec_Cnt;
+    uint8_t* Raw;
+    uint32_t Time;
+    uint32_t Last;
+    uint64_t Wraps;
+
+    File=fopen(Path,"rb");
+    if(File==0)
+        return -1;
+    Size=fread(Buf,1,sizeof(Buf),File);
+    fclose(File);
+    if((Size<2+TRACE_REC_SIZE)||((Size-2)%TRACE_REC_SIZE!=0))
+        return -1;
+
+    Slots=(Size-2)/TRACE_REC_SIZE;
+    Head=Buf[0];
+    if(Head>=Slots)
+        return -1;
+    /* If the ring was filled, the oldest record is the one at the head */
+    if(Buf[1]!=0)
+    {
+        Count=Slots;
+        First=Head;
+    }
+    else
+    {
+        Count=Head;
+        First=0;
+    }
+
+    Last=0;
+    Wraps=0;
+    for(Rec_Cnt=0;Rec_Cnt<Count;Rec_Cnt++)
+    {
+        Raw=&Buf[2+((First+Rec_Cnt)%Slots)*TRACE_REC_SIZE];
+        Rec[Rec_Cnt].Type=Raw[0];
+        Rec[Rec_Cnt].TID=Raw[1];
+        Rec[Rec_Cnt].Arg1=Raw[2];
+        Rec[Rec_Cnt].Arg2=Raw[3];
+        Time=(((uint32_t)Raw[4])<<24)|(((uint32_t)Raw[5])<<16)|
+             (((uint32_t)Raw[6])<<8)|Raw[7];
+        /* The time only goes backwards when it wraps */
+        if((Rec_Cnt!=0)&&(Time<Last))
+            Wraps++;
+        Last=Time;
+        Rec[Rec_Cnt].Time=(Wraps<<32)|Time;
+    }
+
+    return Count;
+}
+/* End Function:Decode_Load **************************************************/
+
+/* Begin Function:Decode_Print ************************************************
+Description : Print the records as a timeline, with the time relative to the
+              first record.
+Input       : int Count - The number of records.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void Decode_Print(int Count)
+{
+    int Rec_Cnt;
+    uint64_t Time;
+
+    for(Rec_Cnt=0;Rec_Cnt<Count;Rec_Cnt++)
+    {
+        Time=Rec[Rec_Cnt].Time-Rec[0].Time;
+        printf("%12llu  ",(unsigned long long)Time);
+        switch(Rec[Rec_Cnt].Type)
+        {
+            case TRACE_SWITCH:
+                printf("switch  %3u -> %u\n",Rec[Rec_Cnt].TID,Rec[Rec_Cnt].Arg1);
+                break;
+            case TRACE_SIGNAL:
+                printf("signal  %3u -> %u, signal %u\n",Rec[Rec_Cnt].Arg2,
+                       Rec[Rec_Cnt].TID,Rec[Rec_Cnt].Arg1);
+                break;
+            case TRACE_KILL:
+                printf("kill    %3u by %u\n",Rec[Rec_Cnt].TID,Rec[Rec_Cnt].Arg1);
+                break;
+            case TRACE_MALLOC:
+                if(Rec[Rec_Cnt].Arg1==0xFF)
+                    printf("malloc  %3u, %u pages, failed\n",Rec[Rec_Cnt].TID,
+                           Rec[Rec_Cnt].Arg2);
+                else
+                    printf("malloc  %3u, %u pages at page %u\n",Rec[Rec_Cnt].TID,
+                           Rec[Rec_Cnt].Arg2,Rec[Rec_Cnt].Arg1);
+                break;
+            default:
+                printf("unknown type %u\n",Rec[Rec_Cnt].Type);
+                break;
+        }
+    }
+}
+/* End Function:Decode_Print *************************************************/
+
+/* Begin Function:Decode_Usage ************************************************
+Description : Add up the time each thread has run between the switches, and
+              print it as a share of the time from the first switch to the
+              last record. The time before the first switch is not counted, as
+              it is unknown who ran then.
+Input       : int Count - The number of records.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void Decode_Usage(int Count)
+{
+    int Rec_Cnt;
+    int Running;
+    int TID;
+    uint64_t Start;
+    uint64_t Since;
+    uint64_t Total;
+
+    Running=-1;
+    Start=0;
+    Since=0;
+    for(Rec_Cnt=0;Rec_Cnt<Count;Rec_Cnt++)
+    {
+        if(Rec[Rec_Cnt].Type!=TRACE_SWITCH)
+            continue;
+        if(Running<0)
+            Start=Rec[Rec_Cnt].Time;
+        else
+            Run_Time[Running]+=Rec[Rec_Cnt].Time-Since;
+        Running=Rec[Rec_Cnt].Arg1;
+        Since=Rec[Rec_Cnt].Time;
+    }
+    if(Running<0)
+    {
+        printf("\nno switches traced\n");
+        return;
+    }
+    Run_Time[Running]+=Rec[Count-1].Time-Since;
+
+    Total=Rec[Count-1].Time-Start;
+    printf("\n TID        time   usage\n");
+    for(TID=0;TID<DECODE_MAX_THREADS;TID++)
+    {
+        if(Run_Time[TID]==0)
+            continue;
+        printf("%4d %11llu  %5.1f%%\n",TID,(unsigned long long)Run_Time[TID],
+               (Total==0)?0.0:(100.0*Run_Time[TID]/Total));
+    }
+}
+/* End Function:Decode_Usage *************************************************/
+
+/* Begin Function:main ********************************************************
+Description : Decode the dump given on the command line.
+Input       : int argc - The number of arguments.
+              char* argv[] - The arguments.
+Output      : None.
+Return      : int - 0 if the dump was decoded, 1 if not.
+******************************************************************************/
+int main(int argc,char* argv[])
+{
+    int Count;
+
+    if(argc!=2)
+    {
+        fprintf(stderr,"usage: %s <trace dump>\n",argv[0]);
+        return 1;
+    }
+
+    Count=Decode_Load(argv[1]);
+    if(Count<0)
+    {
+        fprintf(stderr,"%s is not a trace dump\n",argv[1]);
+        return 1;
+    }
+    if(Count==0)
+    {
+        printf("the trace is empty\n");
+        return 0;
+    }
+
+    Decode_Print(Count);
+    Decode_Usage(Count);
+    return 0;
+}
+/* End Function:main *********************************************************/
+
+/* End Of File ***************************************************************/
+
+/* Copyright (C) 2011-2013 Evo-Devo Instrum. All rights reserved *************/
@@ -17,7 +17,7 @@ Description : The kernel of the RMV RTOS.
 /* Includes ******************************************************************/
 #include "sysconfig.h"
 #define __KERNEL_MEMBERS__
-#include "kernel.h"
+#include "KERNEL.H"
 
 #undef __KERNEL_MEMBERS__
 /* End Includes **************************************************************/
@@ -25,13 +25,21 @@ Description : The kernel of the RMV RTOS.
 /*-------------------------- Scheduler Module ---------------------------------
 The system scheduler module is one that:
 1> Supports 120 number of threads (not processes and pseudo-processes), and the
-   implemented number is only limited by the available RAM of the MCU;
+   implemented number is only limited by the available RAM of the MCU. With
+   ENABLE_STACK_COPY, the threads share one idata stack and only need xdata of
+   their own, so the idata no longer limits the number;
 2> Support dynamic thread management including deletion and setup
 3> Does not require a system timer, just like virus don't have their independent
-   metabolism. 
-4> DOES NOT support priority, but you can get the same functionality by playing
-   some tricks on the signal system.
-5> The system also does not support zombie thread and thread return value.
+   metabolism. A board that can spare one may set ENABLE_TICK, and then also
+   ENABLE_PREEMPT to switch threads when their time slice runs out.
+4> DOES NOT support priority by default, but you can get the same functionality
+   by playing some tricks on the signal system. If ENABLE_PRIORITY is TRUE, each
+   thread gets a priority instead, and the highest priority ready thread always
+   runs. Then there is a ready list for each priority and a bitmap telling which
+   ones are not empty, so choosing the next thread takes constant time.
+5> The system also does not support zombie threads. A thread ends by returning,
+   by Sys_Thread_Exit or by SIGKILL, and its TID is free again at once. With 
+   ENABLE_JOIN, the threads waiting in Sys_Thread_Join get its exit value.
    
 In very tiny places, these features have advantages as follows:
 1> Save a system timer, which is especially important in the 8051 or AVR systems where
@@ -42,6 +50,10 @@ In very tiny places, these features have advantages as follows:
 4> Makes rapid simple system development possible.
 -----------------------------------------------------------------------------*/
 
+/* The functions below are written against the 8051 hardware. Other ports 
+ * provide them in their port files.
+ */
+#if(SYS_PORT==SYS_PORT_MCS51)
 /* Begin Function:DISABLE_ALL_INTS ********************************************
 Description : Disable all interrupts. This function is no longer a assembly one.         
 Input       : None. 
@@ -84,6 +96,140 @@ Return      : None.
 #define SYS_SAVE_SP()  TCB_SP_Now[Current_TID]=SP;                           
 /* End Function:SYS_SAVE_SP **************************************************/
 
+/* Begin Function:SYS_STACK_SAVE **********************************************
+Description : Copy the live part of the shared stack, up to the saved stack 
+              pointer, out to the save area of a thread. Call it after saving SP.
+              A thread that is deeper than STACK_COPY_SIZE would overwrite the 
+              save area of the next one. It is recorded in Sys_Stack_Fault_TID
+              and killed, as ENABLE_STACK_GUARD would, and only its save area is
+              filled. "Init" can't be killed, so it is only recorded.
+Input       : tid_t TID - The thread being switched out.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_STACK_COPY==TRUE)
+#define SYS_STACK_SAVE(TID) \
+{ \
+    u8 idata* Stack=Shared_Stack; \
+    u8 xdata* Save=Stack_Save[TID]; \
+    cnt_t Byte_Cnt; \
+    \
+    Byte_Cnt=TCB_SP_Now[TID]-(ptr_int_t)Shared_Stack+1; \
+    if(Byte_Cnt>STACK_COPY_SIZE) \
+    { \
+        Byte_Cnt=STACK_COPY_SIZE; \
+        Sys_Stack_Fault_TID=TID; \
+        if(TID!=0) \
+            _Sys_Thread_Kill(TID,THREAD_KILLED); \
+    } \
+    for(;Byte_Cnt!=0;Byte_Cnt--) \
+        *Save++=*Stack++; \
+}
+#endif
+/* End Function:SYS_STACK_SAVE ***********************************************/
+
+/* Begin Function:SYS_STACK_LOAD **********************************************
+Description : Copy the saved stack of a thread back into the shared stack. Call
+              it right before loading SP.
+              This must stay a macro and call nothing: a function would have its
+              return address on the very stack that is being overwritten.
+Input       : tid_t TID - The thread being switched in.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_STACK_COPY==TRUE)
+#define SYS_STACK_LOAD(TID) \
+{ \
+    u8 idata* Stack=Shared_Stack; \
+    u8 xdata* Save=Stack_Save[TID]; \
+    cnt_t Byte_Cnt; \
+    \
+    /* Only "Init" can come back deeper than its save area, see SYS_STACK_SAVE */ \
+    Byte_Cnt=TCB_SP_Now[TID]-(ptr_int_t)Shared_Stack+1; \
+    if(Byte_Cnt>STACK_COPY_SIZE) \
+        Byte_Cnt=STACK_COPY_SIZE; \
+    for(;Byte_Cnt!=0;Byte_Cnt--) \
+        *Stack++=*Save++; \
+}
+#endif
+/* End Function:SYS_STACK_LOAD ***********************************************/
+
+/* Tick timer - the Timer 2 of the 8052, in 16-bit auto-reload mode */
+#define SYS_TICK_INTERRUPT      interrupt 5
+#define SYS_TICK_INIT()         {RCAP2H=(TICK_RELOAD)>>8;RCAP2L=(TICK_RELOAD)&0xFF; \
+                                 TH2=RCAP2H;TL2=RCAP2L;T2CON=0x04;ET2=1;}
+#define SYS_TICK_CLEAR()        TF2=0
+#define SYS_TICK_PENDING()      TF2
+/* Setting the overflow flag in software makes the interrupt pending */
+#define SYS_TICK_PEND()         TF2=1
+/* What the tick interrupt pushes after the return address: ACC, B, DPH, DPL, 
+ * PSW, R0-R7 
+ */
+#define SYS_INT_FRAME_SIZE      13
+
+/* Idle mode. An interrupt is not taken right after a write to IE, so setting 
+ * EA only takes effect once the write to PCON has put the CPU to idle: an 
+ * interrupt that comes in between wakes it up instead of being missed. Keep 
+ * the two together.
+ */
+#define SYS_IDLE()              {EA=1;PCON|=0x01;}
+
+/* Profiler timer - the Timer 0, free-running in 16-bit mode */
+#define SYS_PROF_INIT()         {TMOD=(TMOD&0xF0)|0x01;TH0=0;TL0=0;TR0=1;}
+/* The return address of the current function, as LCALL pushed it: low byte 
+ * first. Only valid before the function pushes anything.
+ */
+#define SYS_PROF_CALLER()       ((((ptr_int_t)(*((u8 idata*)SP)))<<8)|(*((u8 idata*)(SP-1))))
+
+/* Begin Function:_Sys_Prof_Time **********************************************
+Description : Read the free-running time for the interrupt-off profiler.
+Input       : None.
+Output      : None.
+Return      : prof_t - The Timer 0 count, in machine cycles.
+******************************************************************************/
+#if((ENABLE_INT_PROF==TRUE)||(ENABLE_TRACE==TRUE)||(ENABLE_IDLE==TRUE))
+prof_t _Sys_Prof_Time(void)
+{
+    u8 High;
+    u8 Low;
+    
+    /* Read again if the low byte overflowed into the high byte meanwhile */
+    do
+    {
+        High=TH0;
+        Low=TL0;
+    }
+    while(High!=TH0);
+    
+    return (((prof_t)High)<<8)|Low;
+}
+#endif
+/* End Function:_Sys_Prof_Time ***********************************************/
+
+/* Begin Function:_Sys_Trace_Time *********************************************
+Description : Read the time for the trace, which is the Timer 0 count made 32 
+              bits wide by counting its wraps. A wrap is only seen if this is 
+              called at least once in between. The caller holds the lock.
+Input       : None.
+Output      : None.
+Return      : u32 - The time, in machine cycles.
+******************************************************************************/
+#if(ENABLE_TRACE==TRUE)
+u32 _Sys_Trace_Time(void)
+{
+    prof_t Now;
+    
+    Now=_Sys_Prof_Time();
+    if(Now<Sys_Trace_Time_Last)
+        Sys_Trace_Time_High++;
+    Sys_Trace_Time_Last=Now;
+    
+    return (((u32)Sys_Trace_Time_High)<<16)|Now;
+}
+#endif
+/* End Function:_Sys_Trace_Time **********************************************/
+#endif
+
 /* Begin Function:_Sys_Int_Init ***********************************************
 Description : Initialize the system interrupt.
 Input       : None.
@@ -93,6 +239,27 @@ Return      : None.
 void _Sys_Int_Init(void)							        	  
 {	
     Interrupt_Lock_Cnt=0;
+#if(ENABLE_INT_PROF==TRUE)
+    Sys_Memset_Xdata(&Sys_Int_Prof,0,sizeof(struct Int_Prof));
+#endif
+#if(ENABLE_TRACE==TRUE)
+    Sys_Memset_Xdata(&Sys_Trace,0,sizeof(struct Trace));
+#if(SYS_PORT==SYS_PORT_MCS51)
+    Sys_Trace_Time_High=0;
+    Sys_Trace_Time_Last=0;
+#endif
+#endif
+#if(ENABLE_IDLE==TRUE)
+    Sys_Memset_Xdata(&Sys_Idle,0,sizeof(struct Idle_Stat));
+    Sys_Idle_Sleeping=0;
+    Sys_Idle_Woken=0;
+#endif
+#if((ENABLE_INT_PROF==TRUE)||(ENABLE_TRACE==TRUE)||(ENABLE_IDLE==TRUE))
+    SYS_PROF_INIT();
+#endif
+#if(ENABLE_TRACE==TRUE)
+    Sys_Trace_Switch_Time=_Sys_Trace_Time();
+#endif
 }
 /* End Function:_Sys_Int_Init ************************************************/
 
@@ -104,6 +271,11 @@ Return      : None.
 ******************************************************************************/
 void Sys_Lock_Interrupt(void)
 {
+#if(ENABLE_INT_PROF==TRUE)
+    /* This must come first, see SYS_PROF_CALLER */
+    ptr_int_t Site=SYS_PROF_CALLER();
+    
+#endif
     if(Interrupt_Lock_Cnt==0)
     {
         /* Disable first before registering it. If an switch occurs between 
@@ -112,6 +284,10 @@ void Sys_Lock_Interrupt(void)
          */
         DISABLE_ALL_INTS();
         Interrupt_Lock_Cnt=1;
+#if(ENABLE_INT_PROF==TRUE)
+        Sys_Int_Prof_Site=Site;
+        Sys_Int_Prof_Start=_Sys_Prof_Time();
+#endif
     }
     else
         Interrupt_Lock_Cnt++;
@@ -126,8 +302,17 @@ Return      : None.
 ******************************************************************************/
 void Sys_Unlock_Interrupt(void)
 {
+#if(ENABLE_INT_PROF==TRUE)
+    /* This must come first, see SYS_PROF_CALLER */
+    ptr_int_t Site=SYS_PROF_CALLER();
+    
+#endif
     if(Interrupt_Lock_Cnt==1)
     {
+#if(ENABLE_INT_PROF==TRUE)
+        /* The bookkeeping itself is not counted */
+        _Sys_Int_Prof_Record(_Sys_Prof_Time()-Sys_Int_Prof_Start,Site);
+#endif
         /* Clear the count before enabling, or it will cause fault in the same
          * sense as above.
          */
@@ -139,6 +324,78 @@ void Sys_Unlock_Interrupt(void)
 }
 /* End Function:Sys_Unlock_Interrupt******************************************/
 
+/* Begin Function:_Sys_Int_Prof_Record ****************************************
+Description : Count one interrupt-off section in the profile. Called by the 
+              outermost Sys_Unlock_Interrupt, before it enables the interrupts.
+Input       : prof_t Time - How long the interrupts were off.
+              ptr_int_t Site - Where they are about to be enabled.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_INT_PROF==TRUE)
+void _Sys_Int_Prof_Record(prof_t Time,ptr_int_t Site)
+{
+    u8 Bin;
+    
+    if(Time>Sys_Int_Prof.Max)
+    {
+        Sys_Int_Prof.Max=Time;
+        Sys_Int_Prof.Max_Lock_Site=Sys_Int_Prof_Site;
+        Sys_Int_Prof.Max_Unlock_Site=Site;
+    }
+    
+    /* The bin is the position of the highest set bit */
+    Bin=0;
+    while((Time>1)&&(Bin<INT_PROF_BINS-1))
+    {
+        Time>>=1;
+        Bin++;
+    }
+    /* The counts stop at their maximum rather than wrap */
+    if(Sys_Int_Prof.Hist[Bin]!=(cnt_t)(-1))
+        Sys_Int_Prof.Hist[Bin]++;
+}
+#endif
+/* End Function:_Sys_Int_Prof_Record *****************************************/
+
+/* Begin Function:Sys_Int_Prof_Read *******************************************
+Description : Take a consistent copy of the interrupt-off profile.
+Input       : None.
+Output      : struct Int_Prof xdata* Prof - The copy.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_INT_PROF==TRUE)
+void Sys_Int_Prof_Read(struct Int_Prof xdata* Prof)
+{
+    cnt_t Bin_Cnt;
+    
+    Sys_Lock_Interrupt();
+    Prof->Max=Sys_Int_Prof.Max;
+    Prof->Max_Lock_Site=Sys_Int_Prof.Max_Lock_Site;
+    Prof->Max_Unlock_Site=Sys_Int_Prof.Max_Unlock_Site;
+    for(Bin_Cnt=0;Bin_Cnt<INT_PROF_BINS;Bin_Cnt++)
+        Prof->Hist[Bin_Cnt]=Sys_Int_Prof.Hist[Bin_Cnt];
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:Sys_Int_Prof_Read ********************************************/
+
+/* Begin Function:Sys_Int_Prof_Reset ******************************************
+Description : Clear the interrupt-off profile, to start a new measurement.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_INT_PROF==TRUE)
+void Sys_Int_Prof_Reset(void)
+{
+    Sys_Lock_Interrupt();
+    Sys_Memset_Xdata(&Sys_Int_Prof,0,sizeof(struct Int_Prof));
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:Sys_Int_Prof_Reset *******************************************/
+
 /* Begin Function:Sys_Create_List *********************************************
 Description : Create a doubly linkled list.
 Input       : struct List_Head* Head - The list head pointer.
@@ -194,13 +451,171 @@ Return      : None.
 ******************************************************************************/
 void Sys_Memset(ptr_int_t Address,s8 Char,size_t Size)		                         
 {
-	s8 xdata* Address_Ptr=(s8*)Address;
-	cnt_t Size_Count;
-	for(Size_Count=Size;Size_Count>0;Size_Count--)
-		*Address_Ptr++=Char;						                         
+    Sys_Memset_Xdata((void xdata*)Address,Char,Size);
 }
 /* End Function:Sys_Memset ***************************************************/
 
+/* Begin Function:Sys_Memset_Xdata ********************************************
+Description : Fill an area of xdata with a byte. The bytes are written 8 per 
+              loop pass, after the odd ones, so that the loop control costs 
+              little; the pointer stays in the DPTR all along.
+Input       : void xdata* Dst - The area.
+              u8 Char - The byte to fill with.
+              size_t Size - The size of the area.
+Output      : None. 
+Return      : None.
+******************************************************************************/
+void Sys_Memset_Xdata(void xdata* Dst,u8 Char,size_t Size)
+{
+    u8 xdata* Dst_Ptr=(u8 xdata*)Dst;
+    size_t Block_Cnt=Size>>3;
+    
+    for(Size&=0x07;Size!=0;Size--)
+        *Dst_Ptr++=Char;
+    for(;Block_Cnt!=0;Block_Cnt--)
+    {
+        *Dst_Ptr++=Char;
+        *Dst_Ptr++=Char;
+        *Dst_Ptr++=Char;
+        *Dst_Ptr++=Char;
+        *Dst_Ptr++=Char;
+        *Dst_Ptr++=Char;
+        *Dst_Ptr++=Char;
+        *Dst_Ptr++=Char;
+    }
+}
+/* End Function:Sys_Memset_Xdata *********************************************/
+
+/* Begin Function:Sys_Memset_Idata ********************************************
+Description : Fill an area of idata with a byte. The idata is at most 256 bytes,
+              so the pointer and the count are a byte each, and a plain loop
+              is already short.
+Input       : void idata* Dst - The area.
+              u8 Char - The byte to fill with.
+              u8 Size - The size of the area.
+Output      : None. 
+Return      : None.
+******************************************************************************/
+void Sys_Memset_Idata(void idata* Dst,u8 Char,u8 Size)
+{
+    u8 idata* Dst_Ptr=(u8 idata*)Dst;
+    
+    for(;Size!=0;Size--)
+        *Dst_Ptr++=Char;
+}
+/* End Function:Sys_Memset_Idata *********************************************/
+
+/* Begin Function:Sys_Memset_Pdata ********************************************
+Description : Fill an area of pdata, the current 256-byte page of xdata, with a 
+              byte. Like the idata, this needs only a byte pointer.
+Input       : void pdata* Dst - The area.
+              u8 Char - The byte to fill with.
+              u8 Size - The size of the area.
+Output      : None. 
+Return      : None.
+******************************************************************************/
+void Sys_Memset_Pdata(void pdata* Dst,u8 Char,u8 Size)
+{
+    u8 pdata* Dst_Ptr=(u8 pdata*)Dst;
+    
+    for(;Size!=0;Size--)
+        *Dst_Ptr++=Char;
+}
+/* End Function:Sys_Memset_Pdata *********************************************/
+
+/* Begin Function:Sys_Memcpy_Xdata ********************************************
+Description : Copy an area of xdata to another one that does not overlap it, 8
+              bytes per loop pass after the odd ones. On parts with two DPTRs,
+              build with the compiler's dual DPTR option so that the two 
+              pointers are not swapped through memory on every byte.
+Input       : void xdata* Dst - The destination.
+              void xdata* Src - The source.
+              size_t Size - The number of bytes.
+Output      : None. 
+Return      : None.
+******************************************************************************/
+void Sys_Memcpy_Xdata(void xdata* Dst,void xdata* Src,size_t Size)
+{
+    u8 xdata* Dst_Ptr=(u8 xdata*)Dst;
+    u8 xdata* Src_Ptr=(u8 xdata*)Src;
+    size_t Block_Cnt=Size>>3;
+    
+    for(Size&=0x07;Size!=0;Size--)
+        *Dst_Ptr++=*Src_Ptr++;
+    for(;Block_Cnt!=0;Block_Cnt--)
+    {
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+    }
+}
+/* End Function:Sys_Memcpy_Xdata *********************************************/
+
+/* Begin Function:Sys_Memcpy_Code *********************************************
+Description : Copy a constant area in code memory to xdata, such as an initial
+              value table, 8 bytes per loop pass after the odd ones.
+Input       : void xdata* Dst - The destination.
+              const void code* Src - The source.
+              size_t Size - The number of bytes.
+Output      : None. 
+Return      : None.
+******************************************************************************/
+void Sys_Memcpy_Code(void xdata* Dst,const void code* Src,size_t Size)
+{
+    u8 xdata* Dst_Ptr=(u8 xdata*)Dst;
+    const u8 code* Src_Ptr=(const u8 code*)Src;
+    size_t Block_Cnt=Size>>3;
+    
+    for(Size&=0x07;Size!=0;Size--)
+        *Dst_Ptr++=*Src_Ptr++;
+    for(;Block_Cnt!=0;Block_Cnt--)
+    {
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+        *Dst_Ptr++=*Src_Ptr++;
+    }
+}
+/* End Function:Sys_Memcpy_Code **********************************************/
+
+/* Begin Function:Sys_Memmove_Xdata *******************************************
+Description : Copy an area of xdata to another one that may overlap it. When 
+              the destination is below the source, an upward copy is safe and
+              Sys_Memcpy_Xdata does it; otherwise the bytes are copied 
+              downwards from the end.
+Input       : void xdata* Dst - The destination.
+              void xdata* Src - The source.
+              size_t Size - The number of bytes.
+Output      : None. 
+Return      : None.
+******************************************************************************/
+void Sys_Memmove_Xdata(void xdata* Dst,void xdata* Src,size_t Size)
+{
+    u8 xdata* Dst_Ptr;
+    u8 xdata* Src_Ptr;
+    
+    if((u8 xdata*)Dst<=(u8 xdata*)Src)
+    {
+        Sys_Memcpy_Xdata(Dst,Src,Size);
+        return;
+    }
+    
+    Dst_Ptr=(u8 xdata*)Dst+Size;
+    Src_Ptr=(u8 xdata*)Src+Size;
+    for(;Size!=0;Size--)
+        *--Dst_Ptr=*--Src_Ptr;
+}
+/* End Function:Sys_Memmove_Xdata ********************************************/
+
 /* Begin Function:_Sys_Scheduler_Init *****************************************
 Description : Initialize the system scheduler.
 Input       : None. 
@@ -214,685 +629,3801 @@ void _Sys_Scheduler_Init(void)
     /* Initialize the ready list and the empty list */
     Sys_Create_List(&Thread_Ready_List_Head);
     Sys_Create_List(&Thread_Empty_List_Head);
+#if(ENABLE_TICK==TRUE)
+    Sys_Create_List(&Thread_Delay_List_Head);
+#endif
+#if(ENABLE_PRIORITY==TRUE)
+    for(Thread_Cnt=0;Thread_Cnt<MAX_PRIORITY;Thread_Cnt++)
+        Sys_Create_List(&Thread_Prio_List_Head[Thread_Cnt]);
+    Thread_Ready_Bitmap=0;
+#endif
     
     /* Clear the system variables */
-    Sys_Memset((ptr_int_t)TCB,0,MAX_THREADS*sizeof(struct Thread_Control_Block));
+    Sys_Memset_Xdata((void xdata*)TCB,0,MAX_THREADS*sizeof(struct Thread_Control_Block));
+    for(Thread_Cnt=0;Thread_Cnt<MAX_THREADS;Thread_Cnt++)
+    {
+        TCB_Status[Thread_Cnt]=0;
+        TCB_Signal[Thread_Cnt]=NOSIG;
+    }
     
-    /* Insert all the nodes into the empty list */
+    /* Insert all the nodes into the empty list. The threads in the static 
+     * table are loaded right away instead, so they are never in it.
+     */
     for(Thread_Cnt=0;Thread_Cnt<MAX_THREADS;Thread_Cnt++)
     {
+        TCB[Thread_Cnt].TID=Thread_Cnt;
+#if(ENABLE_THREAD_TABLE==TRUE)
+        if((Thread_Cnt!=0)&&(Thread_Cnt<=STATIC_THREADS))
+        {
+            _Sys_Thread_Table_Load(Thread_Cnt);
+            continue;
+        }
+#endif
         Sys_List_Insert_Node(&TCB[Thread_Cnt].Head,
                              Thread_Empty_List_Head.Prev,
                              &Thread_Empty_List_Head);
-        
-        TCB[Thread_Cnt].TID=Thread_Cnt;
     }
     
     /* Clear the statistical variable */
     Thread_In_Sys=0;
+#if(ENABLE_MBOX==TRUE)
+    Mbox_List=0;
+#endif
+#if((ENABLE_STACK_GUARD==TRUE)||(ENABLE_STACK_COPY==TRUE))
+    Sys_Stack_Fault_TID=-1;
+#endif
 }
 /* End Function:_Sys_Scheduler_Init ******************************************/
 
-/* Begin Function:_Sys_Thread_Stack_Init **************************************
-Description : Initialize a thread's stack given the TID.
-Input       : tid_t TID - The thread's TID.
+/* Begin Function:_Sys_Ready_Insert *******************************************
+Description : Put a thread into the ready list. In the priority mode it goes to
+              the tail of its priority's list; otherwise to the head of the only 
+              list. This does not change the thread's status.
+Input       : tid_t TID - The thread ID.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-void _Sys_Thread_Stack_Init(tid_t TID)
-{      
-    /* Set the thread entrance */                                                                              
-    *((u8 idata*)(TCB_SP_Now[TID]))=((u16)(TCB[TID].Entrance))>>8;
-    *((u8 idata*)(TCB_SP_Now[TID]-1))=((u16)(TCB[TID].Entrance))&0xff; 
+void _Sys_Ready_Insert(tid_t TID)
+{
+#if(ENABLE_PRIORITY==TRUE)
+    u8 Prio=TCB[TID].Prio;
+    
+    Sys_List_Insert_Node(&TCB[TID].Head,Thread_Prio_List_Head[Prio].Prev,&Thread_Prio_List_Head[Prio]);
+    Thread_Ready_Bitmap|=1<<Prio;
+#else
+    Sys_List_Insert_Node(&TCB[TID].Head,&Thread_Ready_List_Head,Thread_Ready_List_Head.Next);
+#endif
 }
-/* End Function:_Sys_Thread_Stack_Init ***************************************/
+/* End Function:_Sys_Ready_Insert ********************************************/
 
-/* Begin Function:_Sys_Thread_Load ********************************************
-Description : The thread/task loader.
-Input       : struct Thread_Init_Struct* Thread - The thread init struct
+/* Begin Function:_Sys_Ready_Delete *******************************************
+Description : Take a thread out of the ready list. The thread must be in it. 
+              This does not change the thread's status.
+Input       : tid_t TID - The thread ID.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-void _Sys_Thread_Load(struct Thread_Init_Struct* Thread)
-{    
-    tid_t TID=Thread->TID;
-    /* Indicates that this TID is in use */
-    TCB[TID].Status=OCCUPY;   
-    TCB[TID].Thread_Name=Thread->Thread_Name;  
-    TCB[TID].Entrance=(ptr_int_t)(Thread->Entrance);    
-    TCB_SP_Now[TID]=Thread->Init_SP+1;  
-    
-    /* Now delete this thread from the empty list,but not into the running list */
+void _Sys_Ready_Delete(tid_t TID)
+{
     Sys_List_Delete_Node(TCB[TID].Head.Prev,TCB[TID].Head.Next);
-    
-    _Sys_Thread_Stack_Init(TID);
+#if(ENABLE_PRIORITY==TRUE)
+    /* If this priority has no ready threads left, clear its bit */
+    if(Thread_Prio_List_Head[TCB[TID].Prio].Next==&Thread_Prio_List_Head[TCB[TID].Prio])
+        Thread_Ready_Bitmap&=~(1<<TCB[TID].Prio);
+#endif
 }
-/* End Function:_Sys_Thread_Load *********************************************/
+/* End Function:_Sys_Ready_Delete ********************************************/
 
-/* Begin Function:Sys_Start_Thread ********************************************
-Description : The thread/task loader.
-Input       : struct Thread_Init_Struct* Thread - The thread init struct
+/* Begin Function:_Sys_Ready_Insert_Next **************************************
+Description : Put a thread into the ready list so that it runs at the next 
+              switch, if no thread of higher priority is ready: right after the 
+              current thread, or, if that is not ready or is the thread itself, 
+              where the scheduler looks first. This does not change the thread's
+              status.
+Input       : tid_t TID - The thread ID.
 Output      : None.
-Return      : tid_t - If successful,0; else -1.
+Return      : None.
 ******************************************************************************/
-tid_t Sys_Start_Thread(struct Thread_Init_Struct* Thread)
-{    
-    tid_t TID;
-    
-    /* See if the TID member is "AUTO_PID". If not, abort */
-    if(Thread->TID!=AUTO_PID)
-        return -1;   
-    /* Find an empty slot to put the thread in */
-    if(&Thread_Empty_List_Head==Thread_Empty_List_Head.Next)
-        return -1;
-        
-    TID=((struct Thread_Control_Block xdata*)(Thread_Empty_List_Head.Next))->TID;
-    
-    /* Indicates that this TID is in use. */
-    TCB[TID].Status=OCCUPY;   
-    TCB[TID].Thread_Name=Thread->Thread_Name;  
-    TCB[TID].Entrance=(ptr_int_t)(Thread->Entrance);    
-    TCB_SP_Now[TID]=Thread->Init_SP+1;  
+void _Sys_Ready_Insert_Next(tid_t TID)
+{
+#if(ENABLE_PRIORITY==TRUE)
+    u8 Prio=TCB[TID].Prio;
     
-    /* Now delete this thread from the empty list,but not into the running list */
+    /* The TCBs are volatile, but the list is only touched under the lock */
+    if((TID!=Current_TID)&&((TCB_Status[Current_TID]&READY)!=0)&&(TCB[Current_TID].Prio==Prio))
+        Sys_List_Insert_Node((struct List_Head*)&TCB[TID].Head,(struct List_Head*)&TCB[Current_TID].Head,TCB[Current_TID].Head.Next);
+    else
+        Sys_List_Insert_Node((struct List_Head*)&TCB[TID].Head,&Thread_Prio_List_Head[Prio],Thread_Prio_List_Head[Prio].Next);
+    Thread_Ready_Bitmap|=1<<Prio;
+#else
+    /* The TCBs are volatile, but the list is only touched under the lock */
+    if((TID!=Current_TID)&&((TCB_Status[Current_TID]&READY)!=0))
+        Sys_List_Insert_Node((struct List_Head*)&TCB[TID].Head,(struct List_Head*)&TCB[Current_TID].Head,TCB[Current_TID].Head.Next);
+    else
+        Sys_List_Insert_Node((struct List_Head*)&TCB[TID].Head,&Thread_Ready_List_Head,Thread_Ready_List_Head.Next);
+#endif
+}
+/* End Function:_Sys_Ready_Insert_Next ***************************************/
+
+/* Begin Function:_Sys_Wait_Delete ********************************************
+Description : Take a thread out of the wait list of the kernel object it is 
+              blocked on. The thread must be in it. The caller holds the lock.
+Input       : tid_t TID - The thread ID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Wait_Delete(tid_t TID)
+{
     Sys_List_Delete_Node(TCB[TID].Head.Prev,TCB[TID].Head.Next);
-    
-    /* Initialize the thread stack */
-    _Sys_Thread_Stack_Init(TID);
-    
-    return (TID);
+    TCB_Status[TID]&=~WAIT;
 }
-/* End Function:Sys_Start_Thread *********************************************/
+/* End Function:_Sys_Wait_Delete *********************************************/
 
-/* Begin Function:Sys_Set_Ready ***********************************************
-Description : Specify a thread as ready.
-Input       : tid_t TID - The thread that you want to set as ready.
+/* Begin Function:_Sys_Wait ***************************************************
+Description : Make the current thread wait in the wait list of a kernel object,
+              at its tail, and switch away until it is made ready again. The 
+              caller holds the lock, which is released while waiting and held 
+              again on return. The "Init" thread must not wait.
+Input       : struct List_Head xdata* Wait_List - The wait list.
 Output      : None.
-Return      : retval_t - If the function fail, it will return -1.
+Return      : void xdata* - What the thread was given by _Sys_Wait_Wake. If the 
+                            wait was ended by a signal instead, 0.
 ******************************************************************************/
-retval_t Sys_Set_Ready(tid_t TID)
-{    
-    Sys_Lock_Interrupt();
+#if(ENABLE_WAIT==TRUE)
+void xdata* _Sys_Wait(struct List_Head xdata* Wait_List)
+{
+    tid_t TID=Current_TID;
+    void xdata* Data;
     
-    /* See if the thread exists */
-    if(TCB[TID].Status&OCCUPY==0)
-        return -1;
-    /* See if the thread is already ready */
-    if(TCB[TID].Status&READY==1)
-        return -1;
-    /* See if the thread is sleeping */
-    if(TCB[TID].Status&SLEEP==1)
-        return -1;
+    if((TCB_Status[TID]&READY)!=0)
+        _Sys_Ready_Delete(TID);
+    TCB_Status[TID]&=~READY;
+    TCB_Status[TID]|=WAIT;
+    TCB[TID].Wait_Data=0;
+    Sys_List_Insert_Node((struct List_Head*)&TCB[TID].Head,Wait_List->Prev,Wait_List);
+    Sys_Unlock_Interrupt();
     
-    /* Now set the thread as ready */
-    TCB[TID].Status|=READY;
-    Sys_List_Insert_Node(&TCB[TID].Head,&Thread_Ready_List_Head,Thread_Ready_List_Head.Next);
+    Sys_Switch_Now();
     
-    Sys_Unlock_Interrupt();
-    return 0;
+    Sys_Lock_Interrupt();
+    Data=TCB[TID].Wait_Data;
+    TCB[TID].Wait_Data=0;
+    return Data;
 }
-/* End Function:Sys_Set_Ready ************************************************/
+#endif
+/* End Function:_Sys_Wait ****************************************************/
 
-/* Begin Function:_Sys_Load_Init **********************************************
-Description : The function for loading the "Init" thread, the first thread of 
-              the operating system.
-Input       : None.
+/* Begin Function:_Sys_Wait_Ready *********************************************
+Description : Take a thread out of the wait list it is in and make it ready, 
+              giving it something, so that it runs at the next switch. With 
+              priorities, if it is of higher priority than the current thread,
+              the caller should switch at once - see _Sys_Wake_Unlock. The 
+              caller holds the lock.
+Input       : tid_t TID - The waiting thread.
+              void xdata* Data - What to give it. 0 means the wait failed.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-void _Sys_Load_Init(void)
+#if(ENABLE_WAIT==TRUE)
+void _Sys_Wait_Ready(tid_t TID,void xdata* Data)
 {
-    xdata struct Thread_Init_Struct Init;
-    Init.TID=0;                                                       
-    Init.Thread_Name="Init";
-    Init.Init_SP=Kernel_Stack;
-    
-    _Sys_Thread_Load(&Init);
-    Sys_Set_Ready(0);
+    _Sys_Wait_Delete(TID);
+    TCB[TID].Wait_Data=Data;
+    TCB_Status[TID]|=READY;
+    _Sys_Ready_Insert_Next(TID);
+}
+#endif
+/* End Function:_Sys_Wait_Ready **********************************************/
+
+/* Begin Function:_Sys_Wait_Wake **********************************************
+Description : Make the first thread in a wait list ready, as _Sys_Wait_Ready 
+              does. The list must not be empty. The caller holds the lock.
+Input       : struct List_Head xdata* Wait_List - The wait list.
+              void xdata* Data - What to give it. 0 means the wait failed.
+Output      : None.
+Return      : tid_t - The thread made ready.
+******************************************************************************/
+#if(ENABLE_WAIT==TRUE)
+tid_t _Sys_Wait_Wake(struct List_Head xdata* Wait_List,void xdata* Data)
+{
+    tid_t TID;
     
-    /* Set the current TID */
-    Current_TID=0;
-    
-    /* Load its stack pointer */
-    SYS_LOAD_SP();
-    
-    /* Will never return */    
-    _Sys_Init();
+    TID=((struct Thread_Control_Block xdata*)(Wait_List->Next))->TID;
+    _Sys_Wait_Ready(TID,Data);
+    return TID;
 }
-/* End Function:_Sys_Load_Init ***********************************************/
+#endif
+/* End Function:_Sys_Wait_Wake ***********************************************/
 
-/* Begin Function:_Sys_Init_Initial *******************************************
-Description : The function initializing the system and loading the startup 
-              processes.
-Input       : None.
+/* Begin Function:_Sys_Wake_Unlock ********************************************
+Description : Release the lock after making a thread ready. With priorities, if
+              that thread is of higher priority than the current one, switch to
+              it at once; otherwise it just runs at the next switch.
+Input       : tid_t TID - The thread made ready.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-void _Sys_Init_Initial(void)
+#if(ENABLE_WAIT==TRUE)
+void _Sys_Wake_Unlock(tid_t TID)
 {
-    struct Thread_Init_Struct Thread;                                    
-
-    Thread.TID=1;  
-    Thread.Thread_Name="Thread_1";                                                    
-    Thread.Init_SP=App_Stack_1;                                        
-    Thread.Entrance=Task1;                                            
-    _Sys_Thread_Load(&Thread); 
-    Sys_Set_Ready(1);
+#if(ENABLE_PRIORITY==TRUE)
+    if(TCB[TID].Prio>TCB[Current_TID].Prio)
+    {
+        Sys_Unlock_Interrupt();
+        Sys_Switch_Now();
+        return;
+    }
+#endif
+    Sys_Unlock_Interrupt();
 }
-/* End Function:_Sys_Init_Initial ********************************************/
+#endif
+/* End Function:_Sys_Wake_Unlock *********************************************/
 
-/* Begin Function:_Sys_Init_Always ********************************************
-Description : The function initializing the system and loading the startup 
-              processes.
+#if(ENABLE_PRIORITY==TRUE)
+/* The highest set bit in each 4-bit value. The 8051 has no instruction for this */
+static u8 code Sys_Prio_Table[16]={0,0,1,1,2,2,2,2,3,3,3,3,3,3,3,3};
+
+/* Begin Function:_Sys_Get_Highest_Prio ***************************************
+Description : Find the highest priority that has ready threads, in constant time.
 Input       : None.
 Output      : None.
-Return      : None.
+Return      : u8 - The priority. If nothing is ready, 0.
 ******************************************************************************/
-void _Sys_Init_Always(void)
+u8 _Sys_Get_Highest_Prio(void)
 {
-    /* Do nothing now */;
+    u8 Bitmap=Thread_Ready_Bitmap;
+    
+    if((Bitmap&0xF0)!=0)
+        return Sys_Prio_Table[Bitmap>>4]+4;
+    return Sys_Prio_Table[Bitmap];
 }
-/* End Function:_Sys_Init_Always *********************************************/
+/* End Function:_Sys_Get_Highest_Prio ****************************************/
 
-/* Begin Function:_Sys_Init ***************************************************
-Description : This thread will initiate all the latter tasks. 
-Input       : None.
+/* Begin Function:Sys_Set_Prio ************************************************
+Description : Change the priority of a thread. A ready thread moves to the tail
+              of its new priority's list at once. The "Init" thread always 
+              stays at priority 0.
+Input       : tid_t TID - The thread ID.
+              u8 Prio - The new priority.
 Output      : None.
-Return      : None.
+Return      : retval_t - If the operation is invalid, it will return -1; else 0.
 ******************************************************************************/
-void _Sys_Init(void)    	    	    	                                   
+retval_t Sys_Set_Prio(tid_t TID,u8 Prio)
 {
-    _Sys_Init_Initial();
-    while(1)
+    if((TID<=0)||(TID>=MAX_THREADS)||(Prio>=MAX_PRIORITY))
+        return -1;
+    
+    Sys_Lock_Interrupt();
+    
+    if((TCB_Status[TID]&OCCUPY)==0)
     {
-        _Sys_Init_Always();
-        /* Switch out at direct */
-        Sys_Switch_Now();
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    if((TCB_Status[TID]&READY)!=0)
+    {
+        _Sys_Ready_Delete(TID);
+        TCB[TID].Prio=Prio;
+        _Sys_Ready_Insert(TID);
     }
+    else
+        TCB[TID].Prio=Prio;
+    
+    Sys_Unlock_Interrupt();
+    return 0;
 }
-/* End Function:_Sys_Init ****************************************************/
+/* End Function:Sys_Set_Prio *************************************************/
+#endif
 
-/* Begin Function:Sys_Switch_Now **********************************************
-Description : Call the function to trigger a context switch. In the RMV, this is
-              the only way to cause a context switch.
-Input       : None.
+/* Begin Function:_Sys_Thread_Stack_Init **************************************
+Description : Initialize a thread's stack given the TID.
+Input       : tid_t TID - The thread's TID.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-void Sys_Switch_Now(void)
-{
-    Sys_Lock_Interrupt();
-    SYS_SAVE_SP();
-    
-    /* We need to see if the current task is deleted from ths list.
-     * NOTE: See if the task list is empty. If yes, we will still run the same task 
+#if(SYS_PORT==SYS_PORT_MCS51)
+void _Sys_Thread_Stack_Init(tid_t TID)
+{      
+#if(ENABLE_STACK_COPY==TRUE)
+    /* The stack is built in the save area, and copied in when the thread is
+     * first switched to. It will be at the bottom of the shared stack then.
      */
-    if((TCB[Current_TID].Status&READY)==0)
-        Current_TID=((struct Thread_Control_Block xdata*)(Thread_Ready_List_Head.Next))->TID;
-    else
-    {
-        /* If we have reached the end of the list, then rewind the pointer */
-		if(TCB[Current_TID].Head.Next==&Thread_Ready_List_Head)
-			Current_TID=((struct Thread_Control_Block xdata*)(Thread_Ready_List_Head.Next))->TID;
-        else
-			Current_TID=((struct Thread_Control_Block xdata*)(TCB[Current_TID].Head.Next))->TID;
-	}
-        
+    u8 xdata* Stack=Stack_Save[TID];
+#else
+    u8 idata* Stack=(u8 idata*)(TCB_SP_Now[TID]-1);
+#endif
+#if(ENABLE_PREEMPT==TRUE)
+    cnt_t Frame_Cnt;
+#endif
     
-    _Sys_Signal_Handler(Current_TID);       
+#if(ENABLE_STACK_COPY==TRUE)
+    TCB_SP_Now[TID]=(ptr_int_t)Shared_Stack+1;
+#endif
+    /* If the thread function returns, it returns into _Sys_Thread_Return */
+    Stack[1]=((u16)_Sys_Thread_Return)>>8;
+    Stack[0]=((u16)_Sys_Thread_Return)&0xff;
+    /* Set the thread entrance */                                                                              
+    Stack[3]=((u16)(TCB[TID].Entrance))>>8;
+    Stack[2]=((u16)(TCB[TID].Entrance))&0xff; 
+    TCB_SP_Now[TID]+=2;
     
-    SYS_LOAD_SP(); 
-    Sys_Unlock_Interrupt();
+#if(ENABLE_PREEMPT==TRUE)
+    /* The thread will start with the RETI of the tick interrupt, which pops a 
+     * register frame first. Zeros will do, as PSW=0 selects register bank 0.
+     */
+    for(Frame_Cnt=1;Frame_Cnt<=SYS_INT_FRAME_SIZE;Frame_Cnt++)
+        Stack[3+Frame_Cnt]=0;
+    TCB_SP_Now[TID]+=SYS_INT_FRAME_SIZE;
+#endif
 }
-/* End Function:Sys_Switch_Now ***********************************************/
+#endif
+/* End Function:_Sys_Thread_Stack_Init ***************************************/
 
-/* Begin Function:Sys_Get_TID *************************************************
-Description : Get the current thread ID.
+/* Begin Function:_Sys_Thread_Return ******************************************
+Description : Where a thread function returns to. The thread exits with 0.
 Input       : None.
 Output      : None.
-Return      : tid_t - The Current TID.
+Return      : None.
 ******************************************************************************/
-tid_t Sys_Get_TID(void)
+#if(SYS_PORT==SYS_PORT_MCS51)
+void _Sys_Thread_Return(void)
 {
-    return(Current_TID);
+    Sys_Thread_Exit(0);
 }
-/* End Function:Sys_Get_TID **************************************************/
+#endif
+/* End Function:_Sys_Thread_Return *******************************************/
 
-/* Begin Function:main ********************************************************
-Description : The entrance of the OS.
-Input       : None.
+/* Begin Function:_Sys_Stack_Paint ********************************************
+Description : Paint the whole stack of a thread with STACK_PAINT, before it is
+              initialized.
+Input       : tid_t TID - The thread's TID.
 Output      : None.
-Return      : int-dummy.
+Return      : None.
 ******************************************************************************/
-int main(void)    	                                                    
-{    
-    /* Initialize the system interrupt control */
-    _Sys_Int_Init();
-    
-    /* Initialize system memory management module */
-    _Sys_Memory_Init();
-    
-    /* Initialize system scheduler */
-    _Sys_Scheduler_Init();
-    
-    /* Load the first process - The init process */
-    _Sys_Load_Init();                           
-    
-    /* The function above should never return */                                               	    	    	    	    	    	               
-    return(0);  
+#if((SYS_PORT==SYS_PORT_MCS51)&&(ENABLE_STACK_CHECK==TRUE))
+void _Sys_Stack_Paint(tid_t TID)
+{
+    Sys_Memset_Idata((void idata*)(TCB[TID].Stack_Base),STACK_PAINT,TCB[TID].Stack_Size);
 }
-/* End Function:main *********************************************************/
-
-/*--------------------------- Signal Module -----------------------------------
-The signal module supports 7 signals: 3 system signals and 4 use signals. Each
-user signal can be registered a handler function. The signals and their description
-are as follows:
-SIGKILL  Kill the thread instantly.
-SIGSLEEP Make the thread sleep instantly.
-SIGWAKE  Wakeup the thread instantly.
-SIGUSR1  User signal 1.
-SIGUSR2  User signal 1.
-SIGUSR3  User signal 1.
-SIGUSR4  User signal 1.
------------------------------------------------------------------------------*/
+#endif
+/* End Function:_Sys_Stack_Paint *********************************************/
 
-/* Begin Function:_Sys_Signal_Handler *****************************************
-Description : The signal handler.
-Input       : tid_t TID -The thread ID.
+/* Begin Function:_Sys_Stack_Used *********************************************
+Description : Find out how much of its stack a thread has used at most. The 
+              8051 stack grows upwards, so this is up to the highest byte that
+              is no longer painted.
+Input       : tid_t TID - The thread's TID.
 Output      : None.
-Return      : None.
+Return      : cnt_t - The most bytes used.
 ******************************************************************************/
-void _Sys_Signal_Handler(tid_t TID)           	    	    	    	    
+#if((SYS_PORT==SYS_PORT_MCS51)&&(ENABLE_STACK_CHECK==TRUE))
+cnt_t _Sys_Stack_Used(tid_t TID)
 {
-    /* See if there are signals */
-    if(TCB[TID].Signal==0)
-        return;
-    
-    /* We don't scan SIGKILL, SIGSLEEP and SIGWAKE here. They are dealt with directly
-     * when they are send. See if there are user signals.
-     */
-    if(((TCB[TID].Signal&SIGUSR1)!=0)&&(TCB[TID].Signal_Handler[0]!=0))
-    {
-        _Sys_Signal_Handler_Exe=(void(*)(void))TCB[TID].Signal_Handler[0];
-        _Sys_Signal_Handler_Exe();
-    }
-
-    if(((TCB[TID].Signal&SIGUSR2)!=0)&&(TCB[TID].Signal_Handler[1]!=0))
-    {
-        _Sys_Signal_Handler_Exe=(void(*)(void))TCB[TID].Signal_Handler[1];
-        _Sys_Signal_Handler_Exe();
-    }
-
-    if(((TCB[TID].Signal&SIGUSR3)!=0)&&(TCB[TID].Signal_Handler[2]!=0))
-    {
-        _Sys_Signal_Handler_Exe=(void(*)(void))TCB[TID].Signal_Handler[2];
-        _Sys_Signal_Handler_Exe();
-    }  
-
-    if(((TCB[TID].Signal&SIGUSR4)!=0)&&(TCB[TID].Signal_Handler[3]!=0))
-    {
-        _Sys_Signal_Handler_Exe=(void(*)(void))TCB[TID].Signal_Handler[3];
-        _Sys_Signal_Handler_Exe();
-
-    }
+    u8 idata* Stack=(u8 idata*)(TCB[TID].Stack_Base);
+    cnt_t Used=TCB[TID].Stack_Size;
     
-    /* Clear its signal */
-    TCB[TID].Signal=NOSIG;    	    	    	    	    	    	   
+    while((Used!=0)&&(Stack[Used-1]==STACK_PAINT))
+        Used--;
+    return Used;
 }
-/* End Function:_Sys_Signal_Handler ******************************************/
+#endif
+/* End Function:_Sys_Stack_Used **********************************************/
 
-/* Begin Function:_Sys_Thread_Kill ********************************************
-Description : The SIGKILL handler, to kill a certain thread.
-Input       : tid_t TID - The thread ID.
+/* Begin Function:_Sys_Stack_Overflow *****************************************
+Description : See if a thread that was just switched out has overflowed its 
+              stack: its stack pointer is past the end, or the last byte is no
+              longer painted.
+Input       : tid_t TID - The thread's TID.
 Output      : None.
-Return      : None.
+Return      : u8 - If overflowed, 1; else 0.
 ******************************************************************************/
-void _Sys_Thread_Kill(tid_t TID)    	    	    	    	    	  
+#if((SYS_PORT==SYS_PORT_MCS51)&&(ENABLE_STACK_CHECK==TRUE))
+u8 _Sys_Stack_Overflow(tid_t TID)
 {
-    /* It doesn't matter if the TID is the Current_TID */
-    Sys_List_Delete_Node(TCB[TID].Head.Prev,TCB[TID].Head.Next);
-    Sys_Memset((ptr_int_t)(&TCB[TID]),0,sizeof(struct Thread_Control_Block));
-    Sys_List_Insert_Node(&TCB[TID].Head,&Thread_Empty_List_Head,Thread_Empty_List_Head.Next);
-    /* We need the TID marker preserved */
-    TCB[TID].TID=TID;
+    if(TCB_SP_Now[TID]>=TCB[TID].Stack_Base+TCB[TID].Stack_Size)
+        return 1;
+    return (*((u8 idata*)(TCB[TID].Stack_Base+TCB[TID].Stack_Size-1))!=STACK_PAINT);
 }
+#endif
+/* End Function:_Sys_Stack_Overflow ******************************************/
 
-/* End Function:_Sys_Thread_Kill *********************************************/
-
-/* Begin Function:_Sys_Thread_Sleep *******************************************
-Description : The SIGSLEEP handler. In fact executed directly after the signal is
-              send, to make a certain thread sleep.
-Input       : tid_t TID - The thread ID.
+/* Begin Function:_Sys_Thread_Load ********************************************
+Description : The thread/task loader.
+Input       : struct Thread_Init_Struct* Thread - The thread init struct
 Output      : None.
 Return      : None.
 ******************************************************************************/
-void _Sys_Thread_Sleep(tid_t TID)    	    	    	    	    	  
-{
-    /* See if the thread is already sleeping */
-    if(TCB[TID].Status&SLEEP!=0)
-        return;
+void _Sys_Thread_Load(struct Thread_Init_Struct* Thread)
+{    
+    tid_t TID=Thread->TID;
+    /* Indicates that this TID is in use */
+    TCB_Status[TID]=OCCUPY;   
+    TCB[TID].Thread_Name=Thread->Thread_Name;  
+    TCB[TID].Entrance=(ptr_int_t)(Thread->Entrance);    
+    TCB_SP_Now[TID]=Thread->Init_SP+1;  
+#if(ENABLE_PRIORITY==TRUE)
+    TCB[TID].Prio=Thread->Prio;
+#endif
+#if(ENABLE_STACK_CHECK==TRUE)
+    TCB[TID].Stack_Base=Thread->Init_SP;
+    TCB[TID].Stack_Size=Thread->Stack_Size;
+#endif
+#if(ENABLE_JOIN==TRUE)
+    Sys_Create_List((struct List_Head*)&TCB[TID].Join_List);
+    TCB[TID].Exit_Value=0;
+#endif
+#if(ENABLE_TRACE==TRUE)
+    /* A switch may have charged the slot after the last thread in it ended */
+    TCB[TID].Run_Time=0;
+#endif
     
-    TCB[TID].Status|=SLEEP;
-    TCB[TID].Status&=~READY;
+    /* Now delete this thread from the empty list,but not into the running list */
     Sys_List_Delete_Node(TCB[TID].Head.Prev,TCB[TID].Head.Next);
+    
+#if(ENABLE_STACK_CHECK==TRUE)
+    _Sys_Stack_Paint(TID);
+#endif
+    _Sys_Thread_Stack_Init(TID);
 }
-/* End Function:_Sys_Thread_Sleep ********************************************/
-
-/* Begin Function:_Sys_Thread_Wake ********************************************
-Description : The SIGWAKE handler. In fact executed directly after the signal is
+/* End Function:_Sys_Thread_Load *********************************************/
 
-              send, to wake up a certain thread.
-Input       : tid_t TID - The thread ID.
+/* Begin Function:_Sys_Thread_Table_Load **************************************
+Description : Load a thread from the static thread table while the scheduler is
+              set up, and make it ready if the table says so. Its TCB is clear 
+              and in no list yet.
+Input       : tid_t TID - The thread's TID, which is its place in the table plus 1.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-void _Sys_Thread_Wake(tid_t TID)    	    	    	    	    	
+#if(ENABLE_THREAD_TABLE==TRUE)
+void _Sys_Thread_Table_Load(tid_t TID)
 {
-    /* See if the thread is sleeping */
-    if(TCB[TID].Status&SLEEP==0)
-        return;
+    const struct Thread_Table_Struct code* Thread=&Sys_Thread_Table[TID-1];
     
-    TCB[TID].Status&=~(SLEEP);
-    TCB[TID].Status|=READY;
-
-    Sys_List_Insert_Node(&TCB[TID].Head,&Thread_Ready_List_Head,Thread_Ready_List_Head.Next);
-}
-/* End Function:_Sys_Thread_Wake *********************************************/
-
-/* Begin Function:Sys_Send_Signal *********************************************
-Description : The function for sending signals to the threads. You can also send
-              a signal to the callee itself.
-Input       : tid_t TID - The thread ID.
-              signal_t Signal - The signal to send.
-Output      : None.
-Return      : retval_t - If the operation is invalid, it will return -1; else 0.
-******************************************************************************/
-retval_t Sys_Send_Signal(tid_t TID,signal_t Signal)
-{    	    	   
-    /* See if the TID is valid in the signal system */   
-    if((TID==0)||TID>=MAX_THREADS)
-        return -1;
-
-    /* See if the thread exists in the system */
-    if(TCB[TID].Status&OCCUPY==0)
-        return -1;  
+    TCB_Status[TID]=OCCUPY;   
+    TCB[TID].Thread_Name=Thread->Thread_Name;  
+    TCB[TID].Entrance=Thread->Entrance;    
+    TCB_SP_Now[TID]=Thread->Init_SP+1;  
+#if(ENABLE_PRIORITY==TRUE)
+    TCB[TID].Prio=Thread->Prio;
+#endif
+#if(ENABLE_STACK_CHECK==TRUE)
+    TCB[TID].Stack_Base=Thread->Init_SP;
+    TCB[TID].Stack_Size=Thread->Stack_Size;
+    _Sys_Stack_Paint(TID);
+#endif
+#if(ENABLE_JOIN==TRUE)
+    Sys_Create_List((struct List_Head*)&TCB[TID].Join_List);
+#endif
+    _Sys_Thread_Stack_Init(TID);
     
-    switch(Signal)
+    if(Thread->Ready!=0)
     {
-        /* The system signals will be dealt on send */
-        case SIGKILL:_Sys_Thread_Kill(TID);break;
-        case SIGSLEEP:_Sys_Thread_Sleep(TID);break;
-        case SIGWAKE:_Sys_Thread_Wake(TID);break;
-
-        case SIGUSR1:TCB[TID].Signal|=SIGUSR1;break;
-        case SIGUSR2:TCB[TID].Signal|=SIGUSR2;break;
-        case SIGUSR3:TCB[TID].Signal|=SIGUSR3;break;
-        case SIGUSR4:TCB[TID].Signal|=SIGUSR4;break;
-        /* The input is not a signal */
-        default:return -1;
+        TCB_Status[TID]|=READY;
+        _Sys_Ready_Insert(TID);
     }
-    return 0;
 }
-/* End Function:Sys_Send_Signal **********************************************/
+#endif
+/* End Function:_Sys_Thread_Table_Load ***************************************/
 
-/* Begin Function:Sys_Register_Signal_Handler *********************************
-Description : Register the user signal's signal handler.
-Input       : tid_t TID - The thread ID.
-              signal_t Signal - The signal to register the handler.
-              void (*Signal_Handler)(void) - The function pointer to the handler.
+/* Begin Function:Sys_Start_Thread ********************************************
+Description : The thread/task loader.
+Input       : struct Thread_Init_Struct* Thread - The thread init struct
 Output      : None.
-Return      ; retval_t - If succeeded,0; else -1.
+Return      : tid_t - If successful,0; else -1.
 ******************************************************************************/
-retval_t Sys_Reg_Signal_Handler(tid_t TID,signal_t Signal,void (*Signal_Handler)(void))    	    	    
+tid_t Sys_Start_Thread(struct Thread_Init_Struct* Thread)
+{    
+    tid_t TID;
+    
+    /* See if the TID member is "AUTO_PID". If not, abort */
+    if(Thread->TID!=AUTO_PID)
+        return -1;   
+#if(ENABLE_PRIORITY==TRUE)
+    if(Thread->Prio>=MAX_PRIORITY)
+        return -1;
+#endif
+    
+    /* Other threads may start threads too, if they are preempted */
+    Sys_Lock_Interrupt();
+    
+    /* Find an empty slot to put the thread in */
+    if(&Thread_Empty_List_Head==Thread_Empty_List_Head.Next)
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+        
+    TID=((struct Thread_Control_Block xdata*)(Thread_Empty_List_Head.Next))->TID;
+    
+    /* Indicates that this TID is in use. */
+    TCB_Status[TID]=OCCUPY;   
+    TCB[TID].Thread_Name=Thread->Thread_Name;  
+    TCB[TID].Entrance=(ptr_int_t)(Thread->Entrance);    
+    TCB_SP_Now[TID]=Thread->Init_SP+1;  
+#if(ENABLE_PRIORITY==TRUE)
+    TCB[TID].Prio=Thread->Prio;
+#endif
+#if(ENABLE_STACK_CHECK==TRUE)
+    TCB[TID].Stack_Base=Thread->Init_SP;
+    TCB[TID].Stack_Size=Thread->Stack_Size;
+#endif
+#if(ENABLE_JOIN==TRUE)
+    Sys_Create_List((struct List_Head*)&TCB[TID].Join_List);
+    TCB[TID].Exit_Value=0;
+#endif
+#if(ENABLE_TRACE==TRUE)
+    /* A switch may have charged the slot after the last thread in it ended */
+    TCB[TID].Run_Time=0;
+#endif
+    
+    /* Now delete this thread from the empty list,but not into the running list */
+    Sys_List_Delete_Node(TCB[TID].Head.Prev,TCB[TID].Head.Next);
+    
+    /* Initialize the thread stack */
+#if(ENABLE_STACK_CHECK==TRUE)
+    _Sys_Stack_Paint(TID);
+#endif
+    _Sys_Thread_Stack_Init(TID);
+    
+    Sys_Unlock_Interrupt();
+    return (TID);
+}
+/* End Function:Sys_Start_Thread *********************************************/
+
+/* Begin Function:Sys_Set_Ready ***********************************************
+Description : Specify a thread as ready.
+Input       : tid_t TID - The thread that you want to set as ready.
+Output      : None.
+Return      : retval_t - If the function fail, it will return -1.
+******************************************************************************/
+retval_t Sys_Set_Ready(tid_t TID)
+{    
+    if((TID<0)||(TID>=MAX_THREADS))
+        return -1;
+    
+    Sys_Lock_Interrupt();
+    
+    /* See if the thread exists, and is not ready, sleeping, delayed or waiting
+     * already - it is in some list then.
+     */
+    if(((TCB_Status[TID]&OCCUPY)==0)||((TCB_Status[TID]&(READY|SLEEP|DELAY|WAIT))!=0))
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    /* Now set the thread as ready */
+    TCB_Status[TID]|=READY;
+    _Sys_Ready_Insert(TID);
+    
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+/* End Function:Sys_Set_Ready ************************************************/
+
+/* Begin Function:_Sys_Load_Init **********************************************
+Description : The function for loading the "Init" thread, the first thread of 
+              the operating system.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Load_Init(void)
+{
+    xdata struct Thread_Init_Struct Init;
+    Init.TID=0;                                                       
+    Init.Thread_Name="Init";
+    Init.Init_SP=(ptr_int_t)Kernel_Stack;
+#if(ENABLE_STACK_CHECK==TRUE)
+    Init.Stack_Size=KERNEL_STACK_SIZE;
+#endif
+#if(ENABLE_PRIORITY==TRUE)
+    /* Init always runs at the lowest priority */
+    Init.Prio=0;
+#endif
+    
+    _Sys_Thread_Load(&Init);
+    Sys_Set_Ready(0);
+    
+    /* Set the current TID */
+    Current_TID=0;
+    
+    /* Load its stack pointer */
+    SYS_LOAD_SP();
+    
+#if(ENABLE_TICK==TRUE)
+    /* Start the tick only now that we are on the stack of "Init" */
+    _Sys_Tick_Init();
+#endif
+    
+    /* Will never return */    
+    _Sys_Init();
+}
+/* End Function:_Sys_Load_Init ***********************************************/
+
+/* Begin Function:_Sys_Init_Initial *******************************************
+Description : The function initializing the system and loading the startup 
+              processes. With ENABLE_THREAD_TABLE, they are loaded from the 
+              table along with the scheduler instead.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Init_Initial(void)
+{
+#if(ENABLE_THREAD_TABLE==FALSE)
+    struct Thread_Init_Struct Thread;                                    
+
+    Thread.TID=1;  
+    Thread.Thread_Name="Thread_1";                                                    
+    Thread.Init_SP=(ptr_int_t)App_Stack_1;                                        
+#if(ENABLE_STACK_CHECK==TRUE)
+    Thread.Stack_Size=APP_STACK_1_SIZE;
+#endif
+    Thread.Entrance=(ptr_int_t)Task1;
+#if(ENABLE_PRIORITY==TRUE)
+    Thread.Prio=1;
+#endif                                            
+    _Sys_Thread_Load(&Thread); 
+    Sys_Set_Ready(1);
+#endif
+}
+/* End Function:_Sys_Init_Initial ********************************************/
+
+/* Begin Function:_Sys_Init_Always ********************************************
+Description : The function initializing the system and loading the startup 
+              processes.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Init_Always(void)
+{
+#if(ENABLE_MEM_HANDLE==TRUE)
+    /* Compact the heap a little at a time while nothing else needs the CPU */
+    if(Mem.Mem_Compact_Pend!=0)
+        Sys_Mem_Compact(MEM_COMPACT_BUDGET);
+#endif
+}
+/* End Function:_Sys_Init_Always *********************************************/
+
+/* Begin Function:_Sys_Init ***************************************************
+Description : This thread will initiate all the latter tasks. 
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Init(void)    	    	    	                                   
+{
+    _Sys_Init_Initial();
+    while(1)
+    {
+        _Sys_Init_Always();
+#if(ENABLE_IDLE==TRUE)
+        /* Sleep until an interrupt if there is nothing to switch to */
+        _Sys_Idle();
+#endif
+        /* Switch out at direct */
+        Sys_Switch_Now();
+    }
+}
+/* End Function:_Sys_Init ****************************************************/
+
+/* Begin Function:_Sys_Idle_Check *********************************************
+Description : See if the CPU may go idle: no thread but "Init" is ready, and 
+              nothing is left for "Init" or the next switch to do. The caller 
+              holds the lock.
+Input       : None.
+Output      : None.
+Return      : u8 - 1 if it may, 0 if not.
+******************************************************************************/
+#if(ENABLE_IDLE==TRUE)
+u8 _Sys_Idle_Check(void)
+{
+#if(ENABLE_PRIORITY==TRUE)
+    /* "Init" is the only ready thread at priority 0, and nothing is above */
+    if((Thread_Ready_Bitmap!=0x01)||
+       (Thread_Prio_List_Head[0].Next->Next!=&Thread_Prio_List_Head[0]))
+        return 0;
+#else
+    /* "Init" is the only thread in the ready list */
+    if(Thread_Ready_List_Head.Next->Next!=&Thread_Ready_List_Head)
+        return 0;
+#endif
+    /* Signals pending for "Init" run at the next switch */
+    if(TCB_Signal[0]!=NOSIG)
+        return 0;
+#if(ENABLE_ISR_POST==TRUE)
+    /* The sends from interrupts are carried out at the next switch */
+    if(Sys_ISR_Ring_Head!=Sys_ISR_Ring_Tail)
+        return 0;
+#endif
+#if(ENABLE_MEM_HANDLE==TRUE)
+    if(Mem.Mem_Compact_Pend!=0)
+        return 0;
+#endif
+    return 1;
+}
+#endif
+/* End Function:_Sys_Idle_Check **********************************************/
+
+/* Begin Function:_Sys_Idle ***************************************************
+Description : Put the CPU in the idle mode until an interrupt comes, if there is
+              nothing to run. Called by "Init" only.
+              The lock is dropped by hand rather than by Sys_Unlock_Interrupt, 
+              as SYS_IDLE has to be the one that enables the interrupts; the 
+              interrupt-off profiler does not count this section.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_IDLE==TRUE)
+void _Sys_Idle(void)
+{
+    Sys_Lock_Interrupt();
+    if(_Sys_Idle_Check()!=0)
+    {
+        /* The last wakeup did not make any thread ready */
+        Sys_Idle_Woken=0;
+        Sys_Idle_Sleeping=1;
+        Sys_Idle_Start=_Sys_Prof_Time();
+        
+        Interrupt_Lock_Cnt=0;
+        SYS_IDLE();
+        
+        /* If the interrupt switched to another thread, it has been counted */
+        Sys_Lock_Interrupt();
+        _Sys_Idle_Wake();
+    }
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:_Sys_Idle ****************************************************/
+
+/* Begin Function:_Sys_Idle_Wake **********************************************
+Description : Count the idle time when the CPU has woken up. Called by "Init" 
+              after the idle mode, and by the context switch, which can come 
+              first when the interrupt that woke the CPU preempts. The caller 
+              holds the lock.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_IDLE==TRUE)
+void _Sys_Idle_Wake(void)
+{
+    if(Sys_Idle_Sleeping==0)
+        return;
+    
+    Sys_Idle_Sleeping=0;
+    Sys_Idle_Woken=1;
+    Sys_Idle_Wake_Time=_Sys_Prof_Time();
+    Sys_Idle.Time+=(prof_t)(Sys_Idle_Wake_Time-Sys_Idle_Start);
+    /* The count stops at its maximum rather than wrap */
+    if(Sys_Idle.Count!=(cnt_t)(-1))
+        Sys_Idle.Count++;
+}
+#endif
+/* End Function:_Sys_Idle_Wake ***********************************************/
+
+/* Begin Function:Sys_Idle_Read ***********************************************
+Description : Take a consistent copy of the idle statistics. The CPU is busy for
+              the rest of the time, so the utilization over some span is one 
+              minus Time over the span, e.g. from the ticks between a 
+              Sys_Idle_Reset and this.
+Input       : None.
+Output      : struct Idle_Stat xdata* Stat - The copy.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_IDLE==TRUE)
+void Sys_Idle_Read(struct Idle_Stat xdata* Stat)
+{
+    Sys_Lock_Interrupt();
+    Stat->Time=Sys_Idle.Time;
+    Stat->Count=Sys_Idle.Count;
+    Stat->Wake_Max=Sys_Idle.Wake_Max;
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:Sys_Idle_Read ************************************************/
+
+/* Begin Function:Sys_Idle_Reset **********************************************
+Description : Clear the idle statistics, to start a new measurement.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_IDLE==TRUE)
+void Sys_Idle_Reset(void)
+{
+    Sys_Lock_Interrupt();
+    Sys_Memset_Xdata(&Sys_Idle,0,sizeof(struct Idle_Stat));
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:Sys_Idle_Reset ***********************************************/
+
+/* Begin Function:_Sys_Switch_Alone *******************************************
+Description : See if a switch would only come back to the current thread, so 
+              that it can be skipped: no other thread that would run next is 
+              ready, and nothing is pending for the switch to do. "Init" is not
+              counted while it has nothing to do, as its turn would be wasted.
+              The stack guard then only checks the thread at its next real 
+              switch. The caller holds the lock.
+Input       : None.
+Output      : None.
+Return      : u8 - 1 if the switch can be skipped, 0 if not.
+******************************************************************************/
+u8 _Sys_Switch_Alone(void)
+{
+    struct List_Head* Head;
+    struct List_Head* Node;
+    
+    if(((TCB_Status[Current_TID]&READY)==0)||(TCB_Signal[Current_TID]!=NOSIG))
+        return 0;
+#if(ENABLE_ISR_POST==TRUE)
+    if(Sys_ISR_Ring_Head!=Sys_ISR_Ring_Tail)
+        return 0;
+#endif
+    
+#if(ENABLE_PRIORITY==TRUE)
+    /* Only the threads at the current priority can run next */
+    if(_Sys_Get_Highest_Prio()!=TCB[Current_TID].Prio)
+        return 0;
+    Head=&Thread_Prio_List_Head[TCB[Current_TID].Prio];
+#else
+    Head=&Thread_Ready_List_Head;
+#endif
+    /* This looks at 3 nodes at most */
+    for(Node=Head->Next;Node!=Head;Node=Node->Next)
+    {
+        if(Node==&TCB[Current_TID].Head)
+            continue;
+        if((Node==&TCB[0].Head)&&(TCB_Signal[0]==NOSIG))
+        {
+#if(ENABLE_MEM_HANDLE==TRUE)
+            if(Mem.Mem_Compact_Pend==0)
+                continue;
+#else
+            continue;
+#endif
+        }
+        return 0;
+    }
+    return 1;
+}
+/* End Function:_Sys_Switch_Alone ********************************************/
+
+/* Begin Function:_Sys_Switch_Next *******************************************
+Description : Choose the thread to run next and make it Current_TID, then run its
+              pending signal handlers. This is the part of a context switch that 
+              happens between saving and loading the stack pointer, shared by
+              Sys_Switch_Now and the tick interrupt. The caller holds the lock.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Switch_Next(void)
+{
+#if(ENABLE_PRIORITY==TRUE)
+    u8 Prio;
+#endif
+#if(ENABLE_TRACE==TRUE)
+    tid_t Old_TID;
+    u32 Now;
+#endif
+#if(ENABLE_IDLE==TRUE)
+    prof_t Wake;
+#endif
+    
+#if(ENABLE_IDLE==TRUE)
+    /* The interrupt that woke the CPU may be the one switching */
+    _Sys_Idle_Wake();
+#endif
+#if(ENABLE_TRACE==TRUE)
+    /* Charge the thread for the time since it was switched in */
+    Old_TID=Current_TID;
+    Now=_Sys_Trace_Time();
+    TCB[Current_TID].Run_Time+=Now-Sys_Trace_Switch_Time;
+    Sys_Trace_Switch_Time=Now;
+#endif
+#if(ENABLE_STACK_GUARD==TRUE)
+    /* A thread that has run out of stack may have trashed anything; stop it
+     * before it runs again. "Init" can't be killed, so it is only recorded.
+     * A thread that has just exited has no stack to check.
+     */
+    if(((TCB_Status[Current_TID]&OCCUPY)!=0)&&(_Sys_Stack_Overflow(Current_TID)!=0))
+    {
+        Sys_Stack_Fault_TID=Current_TID;
+        if(Current_TID!=0)
+            _Sys_Thread_Kill(Current_TID,THREAD_KILLED);
+    }
+#endif
+#if(ENABLE_ISR_POST==TRUE)
+    /* Deal with the sends from interrupts first, as they may make threads ready */
+    _Sys_ISR_Drain();
+#endif
+    
+#if(ENABLE_PRIORITY==TRUE)
+    /* Run the highest priority. If the current thread is still ready at that 
+     * priority, take the one after it, so that the same priority runs 
+     * round-robin. If nothing is ready, we will still run the same task.
+     */
+    if(Thread_Ready_Bitmap!=0)
+    {
+        Prio=_Sys_Get_Highest_Prio();
+        if(((TCB_Status[Current_TID]&READY)!=0)&&(TCB[Current_TID].Prio==Prio)&&
+           (TCB[Current_TID].Head.Next!=&Thread_Prio_List_Head[Prio]))
+            Current_TID=((struct Thread_Control_Block xdata*)(TCB[Current_TID].Head.Next))->TID;
+        else
+            Current_TID=((struct Thread_Control_Block xdata*)(Thread_Prio_List_Head[Prio].Next))->TID;
+    }
+#else
+    /* We need to see if the current task is deleted from ths list.
+     * NOTE: See if the task list is empty. If yes, we will still run the same task 
+     */
+    if((TCB_Status[Current_TID]&READY)==0)
+        Current_TID=((struct Thread_Control_Block xdata*)(Thread_Ready_List_Head.Next))->TID;
+    else
+    {
+        /* If we have reached the end of the list, then rewind the pointer */
+		if(TCB[Current_TID].Head.Next==&Thread_Ready_List_Head)
+			Current_TID=((struct Thread_Control_Block xdata*)(Thread_Ready_List_Head.Next))->TID;
+        else
+			Current_TID=((struct Thread_Control_Block xdata*)(TCB[Current_TID].Head.Next))->TID;
+	}
+#endif
+
+#if(ENABLE_PREEMPT==TRUE)
+    /* Whoever gets the CPU gets a whole slice */
+    Sys_Slice_Left=PREEMPT_SLICE_TICKS;
+#endif
+#if(ENABLE_IDLE==TRUE)
+    /* Time the first switch to a thread after a wakeup */
+    if((Sys_Idle_Woken!=0)&&(Current_TID!=0))
+    {
+        Sys_Idle_Woken=0;
+        Wake=_Sys_Prof_Time()-Sys_Idle_Wake_Time;
+        if(Wake>Sys_Idle.Wake_Max)
+            Sys_Idle.Wake_Max=Wake;
+    }
+#endif
+#if(ENABLE_TRACE==TRUE)
+    if(Old_TID!=Current_TID)
+        _Sys_Trace(TRACE_SWITCH,Old_TID,Current_TID,0);
+#endif
+    
+    _Sys_Signal_Handler(Current_TID);       
+}
+/* End Function:_Sys_Switch_Next *********************************************/
+
+/* Begin Function:Sys_Switch_Now **********************************************
+Description : Call the function to trigger a context switch. Without preemption,
+              this is the only way to cause a context switch.
+              When the MCS51 port preempts, the switch is left to the tick 
+              interrupt, so that all threads have the same interrupt frame on 
+              their stacks: this just pends that interrupt, and returns after 
+              the thread is scheduled again.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void Sys_Switch_Now(void)
+{
+#if((ENABLE_PREEMPT==TRUE)&&(SYS_PORT==SYS_PORT_MCS51))
+    Sys_Lock_Interrupt();
+    /* Nothing else would run, so don't take the interrupt at all */
+    if(_Sys_Switch_Alone()!=0)
+    {
+        Sys_Unlock_Interrupt();
+        return;
+    }
+    /* A real tick may be pending already. It has to switch then as well as
+     * count, or a thread that has just left the ready list would run on */
+    if(SYS_TICK_PENDING()!=0)
+        Sys_Yield_Pend=YIELD_TICK;
+    else
+        Sys_Yield_Pend=YIELD_ONLY;
+    SYS_TICK_PEND();
+    /* The interrupt is taken when this unlocks */
+    Sys_Unlock_Interrupt();
+#else
+#if(ENABLE_STACK_COPY==TRUE)
+    tid_t Old_TID;
+    
+#endif
+    Sys_Lock_Interrupt();
+    /* Nothing else would run, so there is no context to save and load */
+    if(_Sys_Switch_Alone()!=0)
+    {
+        Sys_Unlock_Interrupt();
+        return;
+    }
+    SYS_SAVE_SP();
+#if(ENABLE_STACK_COPY==TRUE)
+    Old_TID=Current_TID;
+    SYS_STACK_SAVE(Old_TID);
+#endif
+    
+    _Sys_Switch_Next();
+    
+#if(ENABLE_STACK_COPY==TRUE)
+    /* If the same thread runs on, its stack is still in place */
+    if(Old_TID!=Current_TID)
+        SYS_STACK_LOAD(Current_TID);
+#endif
+    SYS_LOAD_SP(); 
+    Sys_Unlock_Interrupt();
+#endif
+}
+/* End Function:Sys_Switch_Now ***********************************************/
+
+/* Begin Function:Sys_Switch_To ***********************************************
+Description : Switch to a certain ready thread at once, rather than to the next
+              one in the ready list, e.g. to hand the CPU from a producer to its
+              consumer. The thread is moved right after the current one, where 
+              the scheduler looks next. With priorities, a thread below the 
+              highest ready priority can't be switched to. A thread of higher 
+              priority made ready by an interrupt meanwhile still goes first.
+Input       : tid_t TID - The thread to switch to.
+Output      : None.
+Return      : retval_t - If the thread is not ready, or is of too low priority,
+                         -1; else 0, after the thread has run. If it is the 
+                         current thread, 0 at once, without any switch.
+******************************************************************************/
+retval_t Sys_Switch_To(tid_t TID)
+{
+    if((TID<0)||(TID>=MAX_THREADS))
+        return -1;
+    /* The thread is already running: there is nothing to hand over */
+    if(TID==Current_TID)
+        return 0;
+    
+    Sys_Lock_Interrupt();
+#if(ENABLE_PRIORITY==TRUE)
+    if(((TCB_Status[TID]&READY)==0)||(TCB[TID].Prio<_Sys_Get_Highest_Prio()))
+#else
+    if((TCB_Status[TID]&READY)==0)
+#endif
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    _Sys_Ready_Delete(TID);
+    _Sys_Ready_Insert_Next(TID);
+    Sys_Unlock_Interrupt();
+    
+    Sys_Switch_Now();
+    return 0;
+}
+/* End Function:Sys_Switch_To ************************************************/
+
+#if(ENABLE_TICK==TRUE)
+/* Begin Function:_Sys_Tick_Init **********************************************
+Description : Start the system tick timer. Called when the "Init" thread is 
+              loaded, so that a tick always finds a valid Current_TID.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Tick_Init(void)
+{
+    Sys_Tick_Cnt=0;
+#if(ENABLE_PREEMPT==TRUE)
+    Sys_Slice_Left=PREEMPT_SLICE_TICKS;
+    Sys_Yield_Pend=YIELD_NONE;
+#endif
+    SYS_TICK_INIT();
+}
+/* End Function:_Sys_Tick_Init ***********************************************/
+
+/* Begin Function:_Sys_Tick_Handler *******************************************
+Description : The system tick interrupt. Counts ticks and, with preemption 
+              enabled, switches the thread when its slice runs out, when it is
+              no longer ready, or when Sys_Switch_Now has pended it. A yield 
+              pended over a real tick does both.
+              On the MCS51 port, the compiler pushes ACC, B, DPH, DPL, PSW and
+              R0-R7 on entry because this calls functions, and pops them before
+              the RETI. So saving SP after that saves the full register context.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Tick_Handler(void) SYS_TICK_INTERRUPT
+{
+#if(ENABLE_PREEMPT==TRUE)
+    u8 Yield;
+#if(ENABLE_STACK_COPY==TRUE)
+    tid_t Old_TID;
+#endif
+    
+#endif
+    SYS_TICK_CLEAR();
+    Sys_Lock_Interrupt();
+#if(ENABLE_TRACE==TRUE)
+    /* Read the trace time, so that it sees every wrap of the timer */
+    _Sys_Trace_Time();
+#endif
+    
+#if(ENABLE_PREEMPT==TRUE)
+    Yield=Sys_Yield_Pend;
+    Sys_Yield_Pend=YIELD_NONE;
+    if(Yield!=YIELD_ONLY)
+    {
+        Sys_Tick_Cnt++;
+        _Sys_Delay_Tick();
+        Sys_Slice_Left--;
+    }
+    /* A yield always switches. So does a tick that finds the thread out of 
+     * the ready list, whatever is left of its slice */
+    if((Yield==YIELD_NONE)&&((TCB_Status[Current_TID]&READY)!=0))
+    {
+        /* See if the slice has run out */
+#if(ENABLE_PRIORITY==TRUE)
+        /* A higher priority thread woken up by the tick runs at once */
+        if((Sys_Slice_Left!=0)&&(_Sys_Get_Highest_Prio()<=TCB[Current_TID].Prio))
+#else
+        if(Sys_Slice_Left!=0)
+#endif
+        {
+            Sys_Unlock_Interrupt();
+            return;
+        }
+        /* If no other thread would run, just start a new slice */
+        if(_Sys_Switch_Alone()!=0)
+        {
+            Sys_Slice_Left=PREEMPT_SLICE_TICKS;
+            Sys_Unlock_Interrupt();
+            return;
+        }
+    }
+    
+    SYS_SAVE_SP();
+#if(ENABLE_STACK_COPY==TRUE)
+    Old_TID=Current_TID;
+    SYS_STACK_SAVE(Old_TID);
+#endif
+    _Sys_Switch_Next();
+#if(ENABLE_STACK_COPY==TRUE)
+    /* If the same thread runs on, its stack is still in place */
+    if(Old_TID!=Current_TID)
+        SYS_STACK_LOAD(Current_TID);
+#endif
+    SYS_LOAD_SP();
+#else
+    Sys_Tick_Cnt++;
+    _Sys_Delay_Tick();
+#endif
+    
+    Sys_Unlock_Interrupt();
+}
+/* End Function:_Sys_Tick_Handler ********************************************/
+
+/* Begin Function:Sys_Get_Tick ************************************************
+Description : Get the number of ticks since the system started.
+Input       : None.
+Output      : None.
+Return      : tick_t - The tick count.
+******************************************************************************/
+tick_t Sys_Get_Tick(void)
+{
+    tick_t Tick;
+    
+    /* The count is wider than the CPU, so read it with the tick held off */
+    Sys_Lock_Interrupt();
+    Tick=Sys_Tick_Cnt;
+    Sys_Unlock_Interrupt();
+    return Tick;
+}
+/* End Function:Sys_Get_Tick *************************************************/
+
+/* Begin Function:_Sys_Delay_Insert *******************************************
+Description : Put a thread into the delay list, which is ordered by wakeup time.
+              Each thread there keeps only the ticks between its predecessor's
+              wakeup and its own, so that a tick only has to look at the head.
+              The thread must not be in any list. The caller holds the lock.
+Input       : tid_t TID - The thread ID.
+              tick_t Ticks - How many ticks from now to wake it up. Not 0.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Delay_Insert(tid_t TID,tick_t Ticks)
+{
+    struct List_Head* Node;
+    
+    /* Walk past everyone who wakes up earlier or at the same tick */
+    Node=Thread_Delay_List_Head.Next;
+    while(Node!=&Thread_Delay_List_Head)
+    {
+        if(Ticks<((struct Thread_Control_Block xdata*)Node)->Delay_Tick)
+        {
+            /* The one after us now waits relative to us */
+            ((struct Thread_Control_Block xdata*)Node)->Delay_Tick-=Ticks;
+            break;
+        }
+        Ticks-=((struct Thread_Control_Block xdata*)Node)->Delay_Tick;
+        Node=Node->Next;
+    }
+    
+    TCB[TID].Delay_Tick=Ticks;
+    TCB_Status[TID]|=DELAY;
+    Sys_List_Insert_Node(&TCB[TID].Head,Node->Prev,Node);
+}
+/* End Function:_Sys_Delay_Insert ********************************************/
+
+/* Begin Function:_Sys_Delay_Delete *******************************************
+Description : Take a thread out of the delay list before it times out. The
+              caller holds the lock.
+Input       : tid_t TID - The thread ID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Delay_Delete(tid_t TID)
+{
+    /* The one after us inherits our remaining ticks */
+    if(TCB[TID].Head.Next!=&Thread_Delay_List_Head)
+        ((struct Thread_Control_Block xdata*)(TCB[TID].Head.Next))->Delay_Tick+=TCB[TID].Delay_Tick;
+    
+    Sys_List_Delete_Node(TCB[TID].Head.Prev,TCB[TID].Head.Next);
+    TCB_Status[TID]&=~DELAY;
+}
+/* End Function:_Sys_Delay_Delete ********************************************/
+
+/* Begin Function:_Sys_Delay_Tick *********************************************
+Description : Count one tick off the delay list, and make every thread whose 
+              time has come ready again. Called by the tick interrupt.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Delay_Tick(void)
+{
+    tid_t TID;
+    
+    if(Thread_Delay_List_Head.Next==&Thread_Delay_List_Head)
+        return;
+    
+    ((struct Thread_Control_Block xdata*)(Thread_Delay_List_Head.Next))->Delay_Tick--;
+    while(Thread_Delay_List_Head.Next!=&Thread_Delay_List_Head)
+    {
+        TID=((struct Thread_Control_Block xdata*)(Thread_Delay_List_Head.Next))->TID;
+        if(TCB[TID].Delay_Tick!=0)
+            break;
+        
+        Sys_List_Delete_Node(&Thread_Delay_List_Head,TCB[TID].Head.Next);
+        TCB_Status[TID]&=~DELAY;
+        TCB_Status[TID]|=READY;
+        _Sys_Ready_Insert(TID);
+    }
+}
+/* End Function:_Sys_Delay_Tick **********************************************/
+
+/* Begin Function:Sys_Delay ***************************************************
+Description : Make the current thread sleep for a number of ticks. It will be 
+              made ready again by the tick, or earlier by a SIGWAKE. The "Init"
+              thread cannot sleep.
+Input       : tick_t Ticks - The number of ticks. If 0, this just yields.
+Output      : None.
+Return      : retval_t - If the operation is invalid, it will return -1; else 0.
+******************************************************************************/
+retval_t Sys_Delay(tick_t Ticks)
+{
+    tid_t TID=Current_TID;
+    
+    if(TID==0)
+        return -1;
+    
+    if(Ticks!=0)
+    {
+        Sys_Lock_Interrupt();
+        if((TCB_Status[TID]&READY)!=0)
+            _Sys_Ready_Delete(TID);
+        TCB_Status[TID]&=~READY;
+        _Sys_Delay_Insert(TID,Ticks);
+        Sys_Unlock_Interrupt();
+    }
+    
+    Sys_Switch_Now();
+    return 0;
+}
+/* End Function:Sys_Delay ****************************************************/
+
+/* Begin Function:Sys_Sleep_Until *********************************************
+Description : Make the current thread sleep until the tick count reaches a value.
+              Use this for periodic work: advancing the wakeup time by the 
+              period each round does not drift, however long the work takes.
+Input       : tick_t Tick - The tick count to wake up at. If that has passed 
+                            already, this just yields.
+Output      : None.
+Return      : retval_t - If the operation is invalid, it will return -1; else 0.
+******************************************************************************/
+retval_t Sys_Sleep_Until(tick_t Tick)
+{
+    tick_t Now;
+    
+    Now=Sys_Get_Tick();
+    /* Compare the difference, so that the wrap-around of the count is fine */
+    if((s32)(Tick-Now)<=0)
+        return Sys_Delay(0);
+    return Sys_Delay(Tick-Now);
+}
+/* End Function:Sys_Sleep_Until **********************************************/
+#endif
+
+/* Begin Function:Sys_Get_Stack_Used ******************************************
+Description : Get the most stack a thread has used since it was started, to size
+              its stack by. Leave a few bytes of margin for the paths that have 
+              not been taken yet.
+Input       : tid_t TID - The thread ID.
+Output      : None.
+Return      : cnt_t - The most bytes used. If the thread does not exist, 0.
+******************************************************************************/
+#if(ENABLE_STACK_CHECK==TRUE)
+cnt_t Sys_Get_Stack_Used(tid_t TID)
+{
+    if((TID<0)||(TID>=MAX_THREADS)||((TCB_Status[TID]&OCCUPY)==0))
+        return 0;
+    return _Sys_Stack_Used(TID);
+}
+#endif
+/* End Function:Sys_Get_Stack_Used *******************************************/
+
+/* Begin Function:Sys_Get_TID *************************************************
+Description : Get the current thread ID.
+Input       : None.
+Output      : None.
+Return      : tid_t - The Current TID.
+******************************************************************************/
+tid_t Sys_Get_TID(void)
+{
+    return(Current_TID);
+}
+/* End Function:Sys_Get_TID **************************************************/
+
+/* Begin Function:main ********************************************************
+Description : The entrance of the OS.
+Input       : None.
+Output      : None.
+Return      : int-dummy.
+******************************************************************************/
+int main(void)    	                                                    
+{    
+    /* Initialize the system interrupt control */
+    _Sys_Int_Init();
+    
+    /* Initialize system memory management module */
+    _Sys_Memory_Init();
+    
+    /* Initialize system scheduler */
+    _Sys_Scheduler_Init();
+    
+    /* Load the first process - The init process */
+    _Sys_Load_Init();                           
+    
+    /* The function above should never return */                                               	    	    	    	    	    	               
+    return(0);  
+}
+/* End Function:main *********************************************************/
+
+/*--------------------------- Signal Module -----------------------------------
+The signal module supports 3 system signals and USER_SIGNALS user signals. Each
+user signal can be registered a handler function. The signals and their description
+are as follows:
+SIGKILL  Kill the thread instantly.
+SIGSLEEP Make the thread sleep instantly.
+SIGWAKE  Wakeup the thread instantly, also from a Sys_Delay or a wait.
+SIGUSR1  User signal 1, and so on to SIGUSR(USER_SIGNALS).
+The system signals are dealt with when they are sent. A user signal is only made
+pending in the bitmask TCB_Signal, and its handler is run when the thread is 
+switched to next. The handlers are found from the bitmask through a table, so a
+switch with no signal pending only tests the bitmask. Without ENABLE_SIGNAL_COUNT
+several sends of the same signal before that run its handler once.
+-----------------------------------------------------------------------------*/
+
+/* The lowest set bit in each 4-bit value. The 8051 has no instruction for this */
+static u8 code Sys_Signal_Table[16]={0,0,1,0,2,0,1,0,3,0,1,0,2,0,1,0};
+
+/* Begin Function:_Sys_Signal_Lowest ******************************************
+Description : Find the lowest pending user signal in a bitmask.
+Input       : sigmask_t Mask - The bitmask. Not 0.
+Output      : None.
+Return      : u8 - The bit number, 0 for SIGUSR1.
+******************************************************************************/
+u8 _Sys_Signal_Lowest(sigmask_t Mask)
+{
+    u8 Base=0;
+    
+#if(USER_SIGNALS>8)
+    if((Mask&0xFF)==0)
+    {
+        Mask>>=8;
+        Base=8;
+    }
+#endif
+#if(USER_SIGNALS>4)
+    if((Mask&0x0F)==0)
+    {
+        Mask>>=4;
+        Base+=4;
+    }
+#endif
+    return Base+Sys_Signal_Table[Mask&0x0F];
+}
+/* End Function:_Sys_Signal_Lowest *******************************************/
+
+/* Begin Function:_Sys_Signal_Handler *****************************************
+Description : The signal handler. Runs the handlers of the pending user signals
+              of a thread, lowest signal first. The signals sent while they run
+              stay pending until the next switch.
+Input       : tid_t TID -The thread ID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Signal_Handler(tid_t TID)           	    	    	    	    
+{
+    sigmask_t Pending;
+    u8 Sig;
+#if(ENABLE_SIGNAL_COUNT==TRUE)
+    u8 Sig_Cnt;
+#endif
+    
+    /* See if there are signals */
+    if(TCB_Signal[TID]==0)
+        return;
+    
+    /* We don't scan SIGKILL, SIGSLEEP and SIGWAKE here. They are dealt with directly
+     * when they are send. Take all the pending user signals at once.
+     */
+    Pending=TCB_Signal[TID];
+    TCB_Signal[TID]=NOSIG;
+    
+    while(Pending!=0)
+    {
+        Sig=_Sys_Signal_Lowest(Pending);
+        Pending&=~(((sigmask_t)1)<<Sig);
+#if(ENABLE_SIGNAL_COUNT==TRUE)
+        Sig_Cnt=TCB[TID].Signal_Cnt[Sig];
+        TCB[TID].Signal_Cnt[Sig]=0;
+#endif
+        if(TCB[TID].Signal_Handler[Sig]==0)
+            continue;
+        
+        _Sys_Signal_Handler_Exe=(void(*)(void))TCB[TID].Signal_Handler[Sig];
+#if(ENABLE_SIGNAL_COUNT==TRUE)
+        /* Once for each send */
+        for(;Sig_Cnt>0;Sig_Cnt--)
+            _Sys_Signal_Handler_Exe();
+#else
+        _Sys_Signal_Handler_Exe();
+#endif
+    }
+}
+/* End Function:_Sys_Signal_Handler ******************************************/
+
+/* Begin Function:_Sys_Thread_Kill ********************************************
+Description : The SIGKILL handler, to kill a certain thread. Also how a thread
+              exits. Everything the thread owns is given up at once: its heap 
+              blocks, its pool blocks, the mutexes it holds, the mailboxes it
+              created, and its TID with its stack. This takes time bounded by 
+              the number of blocks, mutexes and joining threads it has, and by
+              the size of all pools and the number of mailboxes.
+              The caller holds the lock.
+Input       : tid_t TID - The thread ID.
+              ptr_int_t Value - The exit value, for the threads that join it.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Thread_Kill(tid_t TID,ptr_int_t Value)    	    	    	    	    	  
+{
+    /* It doesn't matter if the TID is the Current_TID. Only a ready thread is 
+     * in a list; the list pointers of other threads are stale.
+     */
+#if(ENABLE_TRACE==TRUE)
+    _Sys_Trace(TRACE_KILL,TID,Current_TID,0);
+#endif
+    if((TCB_Status[TID]&READY)!=0)
+        _Sys_Ready_Delete(TID);
+#if(ENABLE_TICK==TRUE)
+    if((TCB_Status[TID]&DELAY)!=0)
+        _Sys_Delay_Delete(TID);
+#endif
+    if((TCB_Status[TID]&WAIT)!=0)
+        _Sys_Wait_Delete(TID);
+    /* It is in no list now. The threads made ready below must not be put after
+     * it, as _Sys_Ready_Insert_Next would do if it still looked ready.
+     */
+    TCB_Status[TID]=OCCUPY;
+#if(ENABLE_SYNC==TRUE)
+    /* The waiters of its mutexes would wait forever */
+    _Sys_Mutex_Release_All(TID);
+#endif
+#if(ENABLE_JOIN==TRUE)
+    while(TCB[TID].Join_List.Next!=&TCB[TID].Join_List)
+        TCB[_Sys_Wait_Wake((struct List_Head xdata*)&TCB[TID].Join_List,(void xdata*)(&TCB[TID]))].Join_Value=Value;
+#endif
+#if(ENABLE_MEMM==TRUE)
+    /* Otherwise the pages stay marked with the TID for good */
+    __Sys_Mfree_All(TID);
+#endif
+#if(ENABLE_MEM_POOL==TRUE)
+    _Sys_Pool_Free_All(TID);
+#endif
+#if(ENABLE_MBOX==TRUE)
+    _Sys_Mbox_Orphan(TID);
+#endif
+    Sys_Memset_Xdata((void xdata*)(&TCB[TID]),0,sizeof(struct Thread_Control_Block));
+    TCB_Status[TID]=0;
+    TCB_Signal[TID]=NOSIG;
+    /* At the tail, so that the TID is used again as late as possible */
+    Sys_List_Insert_Node(&TCB[TID].Head,Thread_Empty_List_Head.Prev,&Thread_Empty_List_Head);
+    /* We need the TID marker preserved */
+    TCB[TID].TID=TID;
+#if(ENABLE_JOIN==TRUE)
+    TCB[TID].Exit_Value=Value;
+#else
+    /* Nobody can join it */
+    (void)Value;
+#endif
+}
+/* End Function:_Sys_Thread_Kill *********************************************/
+
+/* Begin Function:Sys_Thread_Exit *********************************************
+Description : End the current thread, as SIGKILL would, with an exit value for
+              the threads that join it. A thread function that returns exits 
+              with 0. "Init" can't exit.
+Input       : ptr_int_t Value - The exit value.
+Output      : None.
+Return      : None. Only returns when called by "Init".
+******************************************************************************/
+void Sys_Thread_Exit(ptr_int_t Value)
+{
+    if(Current_TID==0)
+        return;
+    
+    Sys_Lock_Interrupt();
+    _Sys_Thread_Kill(Current_TID,Value);
+    Sys_Unlock_Interrupt();
+    
+    /* Never comes back, as the thread is no longer ready */
+    Sys_Switch_Now();
+}
+/* End Function:Sys_Thread_Exit **********************************************/
+
+/* Begin Function:Sys_Thread_Join *********************************************
+Description : Wait for a thread to end, and get its exit value. If it has ended
+              already, the value it ended with is given at once; that is only 
+              right until its TID is used by a new thread, which the empty list
+              puts off as long as it can. "Init" cannot wait.
+Input       : tid_t TID - The thread to wait for.
+Output      : ptr_int_t xdata* Value - The exit value, or THREAD_KILLED. May be 0.
+Return      : retval_t - If the TID is invalid, or the current thread cannot 
+                         wait, or the wait was ended by a signal, -1; else 0.
+******************************************************************************/
+#if(ENABLE_JOIN==TRUE)
+retval_t Sys_Thread_Join(tid_t TID,ptr_int_t xdata* Value)
+{
+    ptr_int_t Exit_Value;
+    
+    if((TID<=0)||(TID>=MAX_THREADS)||(TID==Current_TID)||(Current_TID==0))
+        return -1;
+    
+    Sys_Lock_Interrupt();
+    if((TCB_Status[TID]&OCCUPY)==0)
+        Exit_Value=TCB[TID].Exit_Value;
+    else
+    {
+        if(_Sys_Wait((struct List_Head xdata*)&TCB[TID].Join_List)==0)
+        {
+            Sys_Unlock_Interrupt();
+            return -1;
+        }
+        Exit_Value=TCB[Current_TID].Join_Value;
+    }
+    Sys_Unlock_Interrupt();
+    
+    if(Value!=0)
+        *Value=Exit_Value;
+    return 0;
+}
+#endif
+/* End Function:Sys_Thread_Join **********************************************/
+
+/* Begin Function:_Sys_Thread_Sleep *******************************************
+Description : The SIGSLEEP handler. In fact executed directly after the signal is
+              send, to make a certain thread sleep.
+Input       : tid_t TID - The thread ID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Thread_Sleep(tid_t TID)    	    	    	    	    	  
+{
+    /* See if the thread is already sleeping */
+    if((TCB_Status[TID]&SLEEP)!=0)
+        return;
+    
+    TCB_Status[TID]|=SLEEP;
+    if((TCB_Status[TID]&READY)!=0)
+        _Sys_Ready_Delete(TID);
+    TCB_Status[TID]&=~READY;
+#if(ENABLE_TICK==TRUE)
+    /* A timed sleep becomes an untimed one */
+    if((TCB_Status[TID]&DELAY)!=0)
+        _Sys_Delay_Delete(TID);
+#endif
+    /* So does a wait, which will then end with nothing */
+    if((TCB_Status[TID]&WAIT)!=0)
+        _Sys_Wait_Delete(TID);
+}
+/* End Function:_Sys_Thread_Sleep ********************************************/
+
+/* Begin Function:_Sys_Thread_Wake ********************************************
+Description : The SIGWAKE handler. In fact executed directly after the signal is
+
+              send, to wake up a certain thread.
+Input       : tid_t TID - The thread ID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Thread_Wake(tid_t TID)    	    	    	    	    	
+{
+    /* See if the thread is sleeping */
+#if(ENABLE_TICK==TRUE)
+    if((TCB_Status[TID]&(SLEEP|DELAY|WAIT))==0)
+        return;
+    if((TCB_Status[TID]&DELAY)!=0)
+        _Sys_Delay_Delete(TID);
+#else
+    if((TCB_Status[TID]&(SLEEP|WAIT))==0)
+        return;
+#endif
+    /* A wait ends with nothing */
+    if((TCB_Status[TID]&WAIT)!=0)
+        _Sys_Wait_Delete(TID);
+    
+    TCB_Status[TID]&=~(SLEEP);
+    TCB_Status[TID]|=READY;
+
+    _Sys_Ready_Insert(TID);
+}
+/* End Function:_Sys_Thread_Wake *********************************************/
+
+/* Begin Function:Sys_Send_Signal *********************************************
+Description : The function for sending signals to the threads. You can also send
+              a signal to the callee itself.
+Input       : tid_t TID - The thread ID.
+              signal_t Signal - The signal to send.
+Output      : None.
+Return      : retval_t - If the operation is invalid, it will return -1; else 0.
+******************************************************************************/
+retval_t Sys_Send_Signal(tid_t TID,signal_t Signal)
+{    	    	   
+    /* See if the TID is valid in the signal system. A bad TID can come from an
+     * interrupt through the ISR ring too, so nothing is assumed about it */   
+    if((TID<=0)||(TID>=MAX_THREADS))
+        return -1;
+
+    /* See if the thread exists in the system */
+    if((TCB_Status[TID]&OCCUPY)==0)
+        return -1;  
+    
+    /* The system signals edit the thread lists, which the tick may read */
+    Sys_Lock_Interrupt();
+#if(ENABLE_TRACE==TRUE)
+    _Sys_Trace(TRACE_SIGNAL,TID,Signal,Current_TID);
+#endif
+    switch(Signal)
+    {
+        /* The system signals will be dealt on send */
+        case SIGKILL:_Sys_Thread_Kill(TID,THREAD_KILLED);break;
+        case SIGSLEEP:_Sys_Thread_Sleep(TID);break;
+        case SIGWAKE:_Sys_Thread_Wake(TID);break;
+
+        default:
+        {
+            /* The input is not a signal */
+            if((Signal<SIGUSR1)||(Signal>=SIGUSR1+USER_SIGNALS))
+            {
+                Sys_Unlock_Interrupt();
+                return -1;
+            }
+            
+            TCB_Signal[TID]|=((sigmask_t)1)<<(Signal-SIGUSR1);
+#if(ENABLE_SIGNAL_COUNT==TRUE)
+            /* The count stops at its maximum rather than wrap */
+            if(TCB[TID].Signal_Cnt[Signal-SIGUSR1]!=0xFF)
+                TCB[TID].Signal_Cnt[Signal-SIGUSR1]++;
+#endif
+            break;
+        }
+    }
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+/* End Function:Sys_Send_Signal **********************************************/
+
+/* Begin Function:Sys_Register_Signal_Handler *********************************
+Description : Register the user signal's signal handler.
+Input       : tid_t TID - The thread ID.
+              signal_t Signal - The signal to register the handler.
+              void (*Signal_Handler)(void) - The function pointer to the handler.
+Output      : None.
+Return      ; retval_t - If succeeded,0; else -1.
+******************************************************************************/
+retval_t Sys_Reg_Signal_Handler(tid_t TID,signal_t Signal,void (*Signal_Handler)(void))    	    	    
+{
+    /* See if the TID is valid in the system */   
+    if((TID==0)||(TID>=MAX_THREADS))
+        return -1;
+
+    /* See if the thread exists in the system */
+    if((TCB_Status[TID]&OCCUPY)==0)
+        return -1;    
+
+    /* Other signals and non-signal patterns cannot be registered a handler */        
+    if((Signal<SIGUSR1)||(Signal>=SIGUSR1+USER_SIGNALS))
+        return -1;
+    
+    TCB[TID].Signal_Handler[Signal-SIGUSR1]=(ptr_int_t)Signal_Handler;
+    return 0;
+}
+/* End Function:Sys_Register_Signal_Handler **********************************/
+
+/* Begin Function:_Sys_ISR_Push ***********************************************
+Description : Put a send into the ring of sends from interrupts. This does not
+              lock: the entry is filled in before the tail is moved past it, and
+              the context switch does not read beyond the tail.
+Input       : tid_t TID - The thread ID.
+              signal_t Signal - The signal to send.
+              void xdata* Sem - The semaphore to post instead, or 0.
+Output      : None.
+Return      : retval_t - If the ring is full, -1; else 0.
+******************************************************************************/
+#if(ENABLE_ISR_POST==TRUE)
+retval_t _Sys_ISR_Push(tid_t TID,signal_t Signal,void xdata* Sem)
+{
+    u8 Tail;
+    u8 Next;
+    
+    Tail=Sys_ISR_Ring_Tail;
+    Next=(Tail+1)&(ISR_RING_SIZE-1);
+    if(Next==Sys_ISR_Ring_Head)
+        return -1;
+    
+    Sys_ISR_Ring[Tail].TID=TID;
+    Sys_ISR_Ring[Tail].Signal=Signal;
+    Sys_ISR_Ring[Tail].Sem=Sem;
+    Sys_ISR_Ring_Tail=Next;
+    return 0;
+}
+#endif
+/* End Function:_Sys_ISR_Push ************************************************/
+
+/* Begin Function:Sys_Send_Signal_From_ISR ************************************
+Description : Send a signal to a thread from an interrupt. It is not sent at 
+              once, but at the next context switch, which then acts just like 
+              Sys_Send_Signal. No interrupt is ever disabled.
+Input       : tid_t TID - The thread ID.
+              signal_t Signal - The signal to send.
+Output      : None.
+Return      : retval_t - If the ring is full, -1; else 0. An invalid send is 
+                         only found out at the switch, and dropped.
+******************************************************************************/
+#if(ENABLE_ISR_POST==TRUE)
+retval_t Sys_Send_Signal_From_ISR(tid_t TID,signal_t Signal)
+{
+    return _Sys_ISR_Push(TID,Signal,0);
+}
+#endif
+/* End Function:Sys_Send_Signal_From_ISR *************************************/
+
+/* Begin Function:Sys_Sem_Post_From_ISR ***************************************
+Description : Post a semaphore from an interrupt. Like a signal, it is posted 
+              at the next context switch.
+Input       : struct Semaphore xdata* Sem - The semaphore.
+Output      : None.
+Return      : retval_t - If the ring is full, -1; else 0.
+******************************************************************************/
+#if((ENABLE_ISR_POST==TRUE)&&(ENABLE_SYNC==TRUE))
+retval_t Sys_Sem_Post_From_ISR(struct Semaphore xdata* Sem)
+{
+    return _Sys_ISR_Push(0,NOSIG,(void xdata*)Sem);
+}
+#endif
+/* End Function:Sys_Sem_Post_From_ISR ****************************************/
+
+/* Begin Function:_Sys_ISR_Drain **********************************************
+Description : Carry out the sends from interrupts, in the order they were made.
+              Only the entries that are in the ring on entry are taken, so an 
+              interrupt that keeps sending cannot hold up the switch. Called by
+              the context switch, which holds the lock.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_ISR_POST==TRUE)
+void _Sys_ISR_Drain(void)
+{
+    u8 Head;
+    u8 Tail;
+#if(ENABLE_SYNC==TRUE)
+    struct Semaphore xdata* Sem;
+#endif
+    
+    Head=Sys_ISR_Ring_Head;
+    Tail=Sys_ISR_Ring_Tail;
+    if(Head==Tail)
+        return;
+    
+    while(Head!=Tail)
+    {
+#if(ENABLE_SYNC==TRUE)
+        Sem=(struct Semaphore xdata*)Sys_ISR_Ring[Head].Sem;
+        if(Sem!=0)
+        {
+            /* Just make the waiter ready, as the switch is going on already */
+            if(Sem->Wait_List.Next!=&Sem->Wait_List)
+                _Sys_Wait_Wake(&Sem->Wait_List,(void xdata*)Sem);
+            else if(Sem->Count!=(cnt_t)(-1))
+                Sem->Count++;
+        }
+        else
+#endif
+            Sys_Send_Signal(Sys_ISR_Ring[Head].TID,Sys_ISR_Ring[Head].Signal);
+        Head=(Head+1)&(ISR_RING_SIZE-1);
+    }
+    
+    /* Give the entries back to the interrupts only now */
+    Sys_ISR_Ring_Head=Head;
+}
+#endif
+/* End Function:_Sys_ISR_Drain ***********************************************/
+
+/*--------------------------- Mailbox Module ----------------------------------
+A mailbox passes messages between threads. A message is only a pointer, usually 
+to a buffer from Sys_Malloc, so nothing is copied however large it is. The 
+mailbox keeps a ring of slots for the messages that nobody is waiting for yet. 
+1> A thread that receives from an empty mailbox leaves the ready list and waits
+   in the wait list of the mailbox, taking no CPU time at all.
+2> A send to a mailbox that has waiting threads hands the message to the first 
+   of them directly and makes it ready to run next, without touching the slots.
+3> A buffer from Sys_Malloc belongs to the mailbox (MEM_KERNEL) while it waits 
+   in a slot, and to the receiver once received, which can then free it. So the
+   sender may end at any time after the send. The slots belong to the mailbox 
+   too, and stay until it is deleted. Only its creator can delete it, or any 
+   thread once the creator has ended.
+A waiting thread that is woken up by SIGWAKE, or sent SIGSLEEP, gets no message.
+-----------------------------------------------------------------------------*/
+
+/* Begin Function:Sys_Mbox_Create *********************************************
+Description : Create a mailbox. Its slots are allocated from the heap in the 
+              name of the kernel, so that the mailbox outlives its creator.
+Input       : struct Mailbox xdata* Mbox - The mailbox control block to set up.
+              cnt_t Slots - The number of messages it can hold.
+Output      : None.
+Return      : retval_t - If there is no memory for the slots, -1; else 0.
+******************************************************************************/
+#if(ENABLE_MBOX==TRUE)
+retval_t Sys_Mbox_Create(struct Mailbox xdata* Mbox,cnt_t Slots)
+{
+    if((Slots==0)||(Slots*sizeof(void xdata*)/sizeof(void xdata*)!=Slots))
+        return -1;
+    
+    Mbox->Slot=(void xdata* xdata*)__Sys_Malloc(MEM_KERNEL,Slots*sizeof(void xdata*));
+    if(Mbox->Slot==0)
+        return -1;
+    
+    Sys_Create_List(&Mbox->Wait_List);
+    Mbox->Owner=Current_TID;
+    Mbox->Slot_Num=Slots;
+    Mbox->Head=0;
+    Mbox->Msg_Num=0;
+    
+    Sys_Lock_Interrupt();
+    Mbox->Next=Mbox_List;
+    Mbox_List=Mbox;
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+#endif
+/* End Function:Sys_Mbox_Create **********************************************/
+
+/* Begin Function:Sys_Mbox_Delete *********************************************
+Description : Delete a mailbox, and give its slots back to the heap. This can 
+              only be done by the thread that created it, when it holds no 
+              messages. The threads waiting on it are made ready with nothing.
+              If its creator has ended, any thread can delete it.
+Input       : struct Mailbox xdata* Mbox - The mailbox.
+Output      : None.
+Return      : retval_t - If messages are still in it, or it belongs to another
+                         thread, -1; else 0.
+******************************************************************************/
+#if(ENABLE_MBOX==TRUE)
+retval_t Sys_Mbox_Delete(struct Mailbox xdata* Mbox)
+{
+    struct Mailbox xdata* xdata* Link;
+    
+    Sys_Lock_Interrupt();
+    if((Mbox->Slot==0)||(Mbox->Msg_Num!=0)||
+       ((Mbox->Owner!=Current_TID)&&(Mbox->Owner!=MEM_KERNEL)))
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    /* Take it out of the mailbox list */
+    Link=&Mbox_List;
+    while(*Link!=Mbox)
+        Link=&((*Link)->Next);
+    *Link=Mbox->Next;
+    
+    while(Mbox->Wait_List.Next!=&Mbox->Wait_List)
+        _Sys_Wait_Wake(&Mbox->Wait_List,0);
+    
+    __Sys_Mfree(MEM_KERNEL,Mbox->Slot);
+    Mbox->Slot=0;
+    Mbox->Slot_Num=0;
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+#endif
+/* End Function:Sys_Mbox_Delete **********************************************/
+
+/* Begin Function:_Sys_Mbox_Orphan ********************************************
+Description : Give the mailboxes that a thread being killed has created to the
+              kernel, so that any thread can delete them, and a thread that gets
+              the TID later can't. This takes time bounded by the number of 
+              mailboxes. The caller holds the lock.
+Input       : tid_t TID - The thread ID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MBOX==TRUE)
+void _Sys_Mbox_Orphan(tid_t TID)
+{
+    struct Mailbox xdata* Mbox;
+    
+    for(Mbox=Mbox_List;Mbox!=0;Mbox=Mbox->Next)
+    {
+        if(Mbox->Owner==TID)
+            Mbox->Owner=MEM_KERNEL;
+    }
+}
+#endif
+/* End Function:_Sys_Mbox_Orphan *********************************************/
+
+/* Begin Function:Sys_Mbox_Send ***********************************************
+Description : Send a message to a mailbox. This never blocks. If a thread is 
+              waiting, it gets the message at once; with priorities, it also 
+              runs at once if its priority is higher than the sender's.
+Input       : struct Mailbox xdata* Mbox - The mailbox.
+              void xdata* Msg - The message. It must not be 0.
+Output      : None.
+Return      : retval_t - If the mailbox is full, or the message is 0, -1; else 0.
+******************************************************************************/
+#if(ENABLE_MBOX==TRUE)
+retval_t Sys_Mbox_Send(struct Mailbox xdata* Mbox,void xdata* Msg)
+{
+    cnt_t Tail;
+    tid_t TID;
+    
+    if(Msg==0)
+        return -1;
+    
+    Sys_Lock_Interrupt();
+    if(Mbox->Slot==0)
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    /* Hand it to the first waiting thread if any, buffer and all */
+    if(Mbox->Wait_List.Next!=&Mbox->Wait_List)
+    {
+        TID=_Sys_Wait_Wake(&Mbox->Wait_List,Msg);
+        _Sys_Mem_Give(TID,Msg);
+        _Sys_Wake_Unlock(TID);
+        return 0;
+    }
+    
+    /* Or else put it in a slot */
+    if(Mbox->Msg_Num==Mbox->Slot_Num)
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    Tail=Mbox->Head+Mbox->Msg_Num;
+    if(Tail>=Mbox->Slot_Num)
+        Tail-=Mbox->Slot_Num;
+    Mbox->Slot[Tail]=Msg;
+    Mbox->Msg_Num++;
+    /* The buffer waits in the mailbox's name, whatever becomes of the sender */
+    _Sys_Mem_Give(MEM_KERNEL,Msg);
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+#endif
+/* End Function:Sys_Mbox_Send ************************************************/
+
+/* Begin Function:_Sys_Mbox_Get ***********************************************
+Description : Take the oldest message out of the slots of a mailbox, and give
+              its buffer to the current thread. The caller holds the lock.
+Input       : struct Mailbox xdata* Mbox - The mailbox.
+Output      : None.
+Return      : void xdata* - The message. If there is none, 0.
+******************************************************************************/
+#if(ENABLE_MBOX==TRUE)
+void xdata* _Sys_Mbox_Get(struct Mailbox xdata* Mbox)
+{
+    void xdata* Msg;
+    
+    if(Mbox->Msg_Num==0)
+        return ((void xdata*)0);
+    
+    Msg=Mbox->Slot[Mbox->Head];
+    Mbox->Head++;
+    if(Mbox->Head==Mbox->Slot_Num)
+        Mbox->Head=0;
+    Mbox->Msg_Num--;
+    
+    _Sys_Mem_Give(Current_TID,Msg);
+    return Msg;
+}
+#endif
+/* End Function:_Sys_Mbox_Get ************************************************/
+
+/* Begin Function:Sys_Mbox_Try_Recv *******************************************
+Description : Receive a message from a mailbox if there is one, without blocking.
+Input       : struct Mailbox xdata* Mbox - The mailbox.
+Output      : None.
+Return      : void xdata* - The message. If there is none, 0.
+******************************************************************************/
+#if(ENABLE_MBOX==TRUE)
+void xdata* Sys_Mbox_Try_Recv(struct Mailbox xdata* Mbox)
+{
+    void xdata* Msg;
+    
+    Sys_Lock_Interrupt();
+    Msg=_Sys_Mbox_Get(Mbox);
+    Sys_Unlock_Interrupt();
+    return Msg;
+}
+#endif
+/* End Function:Sys_Mbox_Try_Recv ********************************************/
+
+/* Begin Function:Sys_Mbox_Recv ***********************************************
+Description : Receive a message from a mailbox. If it is empty, the current 
+              thread waits until a message is sent to it. The "Init" thread 
+              cannot wait.
+Input       : struct Mailbox xdata* Mbox - The mailbox.
+Output      : None.
+Return      : void xdata* - The message. If the wait ended without one, or the 
+                            mailbox is not valid, 0.
+******************************************************************************/
+#if(ENABLE_MBOX==TRUE)
+void xdata* Sys_Mbox_Recv(struct Mailbox xdata* Mbox)
 {
-    /* See if the TID is valid in the system */   
-    if((TID==0)||(TID>=MAX_THREADS))
+    tid_t TID=Current_TID;
+    void xdata* Msg;
+    
+    Sys_Lock_Interrupt();
+    if(Mbox->Slot==0)
+    {
+        Sys_Unlock_Interrupt();
+        return ((void xdata*)0);
+    }
+    
+    Msg=_Sys_Mbox_Get(Mbox);
+    if((Msg!=0)||(TID==0))
+    {
+        Sys_Unlock_Interrupt();
+        return Msg;
+    }
+    
+    /* Nothing there - wait in the mailbox until the sender makes us ready. The
+     * sender has given us the buffer already */
+    Msg=_Sys_Wait(&Mbox->Wait_List);
+    Sys_Unlock_Interrupt();
+    return Msg;
+}
+#endif
+/* End Function:Sys_Mbox_Recv ************************************************/
+
+/*------------------------ Synchronization Module -----------------------------
+Mutexes, counting semaphores and event flag groups. A thread that cannot take 
+one waits in its wait list, out of the ready list, and only a release makes it
+ready again:
+1> Unlocking a mutex that has waiting threads gives it to the first of them 
+   directly. It is made ready to run at the next switch, so a contended lock 
+   changes hands in one switch, and the thread that unlocked cannot take it back
+   in the meantime.
+2> Posting a semaphore that has waiting threads likewise gives the count to the
+   first of them instead of incrementing it.
+3> Setting event flags makes every thread whose wait they satisfy ready, in one
+   critical section. Each waiting thread keeps its own flags and options in its
+   TCB, so the set does not need to look anywhere else.
+A waiting thread that is woken up by SIGWAKE, or sent SIGSLEEP, gets nothing, 
+and its lock or wait call fails.
+-----------------------------------------------------------------------------*/
+
+/* Begin Function:Sys_Mutex_Create ********************************************
+Description : Create a mutex, unlocked.
+Input       : struct Mutex xdata* Mutex - The mutex to set up.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+void Sys_Mutex_Create(struct Mutex xdata* Mutex)
+{
+    Sys_Create_List(&Mutex->Wait_List);
+    Mutex->Owner=SYNC_FREE;
+    Mutex->Held_Next=0;
+}
+#endif
+/* End Function:Sys_Mutex_Create *********************************************/
+
+/* Begin Function:_Sys_Mutex_Take *********************************************
+Description : Make a thread the owner of a free mutex, and add the mutex to the
+              ones it holds. The caller holds the lock.
+Input       : struct Mutex xdata* Mutex - The mutex.
+              tid_t TID - The new owner.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+void _Sys_Mutex_Take(struct Mutex xdata* Mutex,tid_t TID)
+{
+    Mutex->Owner=TID;
+    Mutex->Held_Next=TCB[TID].Mutex_Held;
+    TCB[TID].Mutex_Held=Mutex;
+}
+#endif
+/* End Function:_Sys_Mutex_Take **********************************************/
+
+/* Begin Function:_Sys_Mutex_Held_Delete **************************************
+Description : Take a mutex out of the ones its owner holds. Mutexes are mostly
+              unlocked the last locked first, so it is usually at the head. The
+              caller holds the lock.
+Input       : struct Mutex xdata* Mutex - The mutex.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+void _Sys_Mutex_Held_Delete(struct Mutex xdata* Mutex)
+{
+    struct Mutex xdata* xdata* Link;
+    
+    Link=(struct Mutex xdata* xdata*)&TCB[Mutex->Owner].Mutex_Held;
+    while(*Link!=Mutex)
+        Link=&((*Link)->Held_Next);
+    *Link=Mutex->Held_Next;
+    Mutex->Held_Next=0;
+}
+#endif
+/* End Function:_Sys_Mutex_Held_Delete ***************************************/
+
+/* Begin Function:_Sys_Mutex_Release_All **************************************
+Description : Give up all mutexes a thread holds, when it is killed. Each goes
+              to the first of its waiters, who is made ready, or becomes free.
+              The caller holds the lock.
+Input       : tid_t TID - The thread.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+void _Sys_Mutex_Release_All(tid_t TID)
+{
+    struct Mutex xdata* Mutex;
+    
+    while(TCB[TID].Mutex_Held!=0)
+    {
+        Mutex=TCB[TID].Mutex_Held;
+        TCB[TID].Mutex_Held=Mutex->Held_Next;
+        Mutex->Held_Next=0;
+        
+        if(Mutex->Wait_List.Next==&Mutex->Wait_List)
+            Mutex->Owner=SYNC_FREE;
+        else
+            _Sys_Mutex_Take(Mutex,_Sys_Wait_Wake(&Mutex->Wait_List,(void xdata*)Mutex));
+    }
+}
+#endif
+/* End Function:_Sys_Mutex_Release_All ***************************************/
+
+/* Begin Function:Sys_Mutex_Delete ********************************************
+Description : Delete a mutex. It must not be locked; the threads waiting on it
+              are made ready, and their lock calls fail.
+Input       : struct Mutex xdata* Mutex - The mutex.
+Output      : None.
+Return      : retval_t - If the mutex is locked, -1; else 0.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+retval_t Sys_Mutex_Delete(struct Mutex xdata* Mutex)
+{
+    Sys_Lock_Interrupt();
+    if(Mutex->Owner!=SYNC_FREE)
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    while(Mutex->Wait_List.Next!=&Mutex->Wait_List)
+        _Sys_Wait_Wake(&Mutex->Wait_List,0);
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+#endif
+/* End Function:Sys_Mutex_Delete *********************************************/
 
+/* Begin Function:Sys_Mutex_Try_Lock ******************************************
+Description : Lock a mutex if it is free, without blocking.
+Input       : struct Mutex xdata* Mutex - The mutex.
+Output      : None.
+Return      : retval_t - If the mutex is not free, -1; else 0.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+retval_t Sys_Mutex_Try_Lock(struct Mutex xdata* Mutex)
+{
+    Sys_Lock_Interrupt();
+    if(Mutex->Owner!=SYNC_FREE)
+    {
+        Sys_Unlock_Interrupt();
         return -1;
+    }
+    
+    _Sys_Mutex_Take(Mutex,Current_TID);
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+#endif
+/* End Function:Sys_Mutex_Try_Lock *******************************************/
 
-    /* See if the thread exists in the system */
-    if(TCB[TID].Status&OCCUPY==0)
-        return -1;    
+/* Begin Function:Sys_Mutex_Lock **********************************************
+Description : Lock a mutex. If another thread holds it, the current thread waits
+              until it is given the mutex. The mutex does not nest, and the 
+              "Init" thread cannot wait.
+Input       : struct Mutex xdata* Mutex - The mutex.
+Output      : None.
+Return      : retval_t - If the current thread holds it already, or cannot wait,
+                         or the wait ended without the mutex, -1; else 0.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+retval_t Sys_Mutex_Lock(struct Mutex xdata* Mutex)
+{
+    Sys_Lock_Interrupt();
+    if(Mutex->Owner==SYNC_FREE)
+    {
+        _Sys_Mutex_Take(Mutex,Current_TID);
+        Sys_Unlock_Interrupt();
+        return 0;
+    }
+    
+    if((Mutex->Owner==Current_TID)||(Current_TID==0))
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    /* The unlocking thread makes us the owner before it makes us ready */
+    if(_Sys_Wait(&Mutex->Wait_List)==0)
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+#endif
+/* End Function:Sys_Mutex_Lock ***********************************************/
+
+/* Begin Function:Sys_Mutex_Unlock ********************************************
+Description : Unlock a mutex held by the current thread. If threads are waiting,
+              the first of them gets it.
+Input       : struct Mutex xdata* Mutex - The mutex.
+Output      : None.
+Return      : retval_t - If the current thread does not hold it, -1; else 0.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+retval_t Sys_Mutex_Unlock(struct Mutex xdata* Mutex)
+{
+    tid_t TID;
+    
+    Sys_Lock_Interrupt();
+    if(Mutex->Owner!=Current_TID)
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    _Sys_Mutex_Held_Delete(Mutex);
+    if(Mutex->Wait_List.Next==&Mutex->Wait_List)
+    {
+        Mutex->Owner=SYNC_FREE;
+        Sys_Unlock_Interrupt();
+        return 0;
+    }
+    
+    /* Hand it over */
+    TID=_Sys_Wait_Wake(&Mutex->Wait_List,(void xdata*)Mutex);
+    _Sys_Mutex_Take(Mutex,TID);
+    _Sys_Wake_Unlock(TID);
+    return 0;
+}
+#endif
+/* End Function:Sys_Mutex_Unlock *********************************************/
+
+/* Begin Function:Sys_Sem_Create **********************************************
+Description : Create a counting semaphore.
+Input       : struct Semaphore xdata* Sem - The semaphore to set up.
+              cnt_t Count - The initial count.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+void Sys_Sem_Create(struct Semaphore xdata* Sem,cnt_t Count)
+{
+    Sys_Create_List(&Sem->Wait_List);
+    Sem->Count=Count;
+}
+#endif
+/* End Function:Sys_Sem_Create ***********************************************/
+
+/* Begin Function:Sys_Sem_Delete **********************************************
+Description : Delete a semaphore. The threads waiting on it are made ready, and
+              their wait calls fail.
+Input       : struct Semaphore xdata* Sem - The semaphore.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+void Sys_Sem_Delete(struct Semaphore xdata* Sem)
+{
+    Sys_Lock_Interrupt();
+    while(Sem->Wait_List.Next!=&Sem->Wait_List)
+        _Sys_Wait_Wake(&Sem->Wait_List,0);
+    Sem->Count=0;
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:Sys_Sem_Delete ***********************************************/
+
+/* Begin Function:Sys_Sem_Try_Wait ********************************************
+Description : Take one count from a semaphore if it has any, without blocking.
+Input       : struct Semaphore xdata* Sem - The semaphore.
+Output      : None.
+Return      : retval_t - If the count is 0, -1; else 0.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+retval_t Sys_Sem_Try_Wait(struct Semaphore xdata* Sem)
+{
+    Sys_Lock_Interrupt();
+    if(Sem->Count==0)
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    Sem->Count--;
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+#endif
+/* End Function:Sys_Sem_Try_Wait *********************************************/
+
+/* Begin Function:Sys_Sem_Wait ************************************************
+Description : Take one count from a semaphore. If the count is 0, the current 
+              thread waits until a post gives it one. The "Init" thread cannot
+              wait.
+Input       : struct Semaphore xdata* Sem - The semaphore.
+Output      : None.
+Return      : retval_t - If the thread cannot wait, or the wait ended without a
+                         count, -1; else 0.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+retval_t Sys_Sem_Wait(struct Semaphore xdata* Sem)
+{
+    Sys_Lock_Interrupt();
+    if(Sem->Count!=0)
+    {
+        Sem->Count--;
+        Sys_Unlock_Interrupt();
+        return 0;
+    }
+    
+    if(Current_TID==0)
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    if(_Sys_Wait(&Sem->Wait_List)==0)
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    Sys_Unlock_Interrupt();
+    return 0;
+}
+#endif
+/* End Function:Sys_Sem_Wait *************************************************/
+
+/* Begin Function:Sys_Sem_Post ************************************************
+Description : Give one count to a semaphore. If threads are waiting, the first 
+              of them gets it. This never blocks.
+Input       : struct Semaphore xdata* Sem - The semaphore.
+Output      : None.
+Return      : retval_t - If the count would overflow, -1; else 0.
+******************************************************************************/
+#if(ENABLE_SYNC==TRUE)
+retval_t Sys_Sem_Post(struct Semaphore xdata* Sem)
+{
+    Sys_Lock_Interrupt();
+    if(Sem->Wait_List.Next==&Sem->Wait_List)
+    {
+        if(Sem->Count==(cnt_t)(-1))
+        {
+            Sys_Unlock_Interrupt();
+            return -1;
+        }
+        Sem->Count++;
+        Sys_Unlock_Interrupt();
+        return 0;
+    }
+    
+    _Sys_Wake_Unlock(_Sys_Wait_Wake(&Sem->Wait_List,(void xdata*)Sem));
+    return 0;
+}
+#endif
+/* End Function:Sys_Sem_Post *************************************************/
+
+/* Begin Function:Sys_Event_Create ********************************************
+Description : Create an event flag group, with all flags cleared.
+Input       : struct Event xdata* Event - The event flag group to set up.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_EVENT==TRUE)
+void Sys_Event_Create(struct Event xdata* Event)
+{
+    Sys_Create_List(&Event->Wait_List);
+    Event->Flags=0;
+}
+#endif
+/* End Function:Sys_Event_Create *********************************************/
+
+/* Begin Function:Sys_Event_Delete ********************************************
+Description : Delete an event flag group. The threads waiting on it are made 
+              ready, and their wait calls fail.
+Input       : struct Event xdata* Event - The event flag group.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_EVENT==TRUE)
+void Sys_Event_Delete(struct Event xdata* Event)
+{
+    Sys_Lock_Interrupt();
+    while(Event->Wait_List.Next!=&Event->Wait_List)
+        _Sys_Wait_Wake(&Event->Wait_List,0);
+    Event->Flags=0;
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:Sys_Event_Delete *********************************************/
+
+/* Begin Function:_Sys_Event_Match ********************************************
+Description : See if the flags of an event satisfy a wait.
+Input       : flag_t Flags - The flags of the event.
+              flag_t Wait_Flags - The flags waited for.
+              u8 Opt - EVENT_ANY or EVENT_ALL, maybe with EVENT_CLEAR.
+Output      : None.
+Return      : u8 - If satisfied, 1; else 0.
+******************************************************************************/
+#if(ENABLE_EVENT==TRUE)
+u8 _Sys_Event_Match(flag_t Flags,flag_t Wait_Flags,u8 Opt)
+{
+    if((Opt&EVENT_ALL)!=0)
+        return ((Flags&Wait_Flags)==Wait_Flags);
+    return ((Flags&Wait_Flags)!=0);
+}
+#endif
+/* End Function:_Sys_Event_Match *********************************************/
+
+/* Begin Function:Sys_Event_Set ***********************************************
+Description : Set some flags of an event, and make every thread whose wait is 
+              now satisfied ready, all in one critical section. All of them see
+              the same flags; the flags that any of them waited for with 
+              EVENT_CLEAR are cleared after that. This never blocks.
+Input       : struct Event xdata* Event - The event flag group.
+              flag_t Flags - The flags to set.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_EVENT==TRUE)
+void Sys_Event_Set(struct Event xdata* Event,flag_t Flags)
+{
+    struct List_Head* Node;
+    tid_t TID;
+    tid_t Wake_TID;
+    flag_t Clear_Flags;
+    
+    Sys_Lock_Interrupt();
+    Event->Flags|=Flags;
+    
+    /* Each one woken up runs next, so walk from the tail to keep them in order */
+    Wake_TID=Current_TID;
+    Clear_Flags=0;
+    Node=Event->Wait_List.Prev;
+    while(Node!=&Event->Wait_List)
+    {
+        TID=((struct Thread_Control_Block xdata*)Node)->TID;
+        Node=Node->Prev;
+        if(_Sys_Event_Match(Event->Flags,TCB[TID].Wait_Flags,TCB[TID].Wait_Opt)==0)
+            continue;
+        
+        if((TCB[TID].Wait_Opt&EVENT_CLEAR)!=0)
+            Clear_Flags|=TCB[TID].Wait_Flags;
+        TCB[TID].Wait_Flags=Event->Flags;
+        _Sys_Wait_Ready(TID,(void xdata*)Event);
+#if(ENABLE_PRIORITY==TRUE)
+        if(TCB[TID].Prio>TCB[Wake_TID].Prio)
+            Wake_TID=TID;
+#endif
+    }
+    
+    Event->Flags&=~Clear_Flags;
+    _Sys_Wake_Unlock(Wake_TID);
+}
+#endif
+/* End Function:Sys_Event_Set ************************************************/
+
+/* Begin Function:Sys_Event_Clear *********************************************
+Description : Clear some flags of an event.
+Input       : struct Event xdata* Event - The event flag group.
+              flag_t Flags - The flags to clear.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_EVENT==TRUE)
+void Sys_Event_Clear(struct Event xdata* Event,flag_t Flags)
+{
+    Sys_Lock_Interrupt();
+    Event->Flags&=~Flags;
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:Sys_Event_Clear **********************************************/
+
+/* Begin Function:Sys_Event_Try_Wait ******************************************
+Description : See if the flags of an event satisfy a wait, without blocking.
+Input       : struct Event xdata* Event - The event flag group.
+              flag_t Flags - The flags to wait for.
+              u8 Opt - EVENT_ANY or EVENT_ALL, maybe with EVENT_CLEAR.
+Output      : None.
+Return      : flag_t - If satisfied, the flags of the event before any clearing;
+                       else 0.
+******************************************************************************/
+#if(ENABLE_EVENT==TRUE)
+flag_t Sys_Event_Try_Wait(struct Event xdata* Event,flag_t Flags,u8 Opt)
+{
+    flag_t Event_Flags;
+    
+    Sys_Lock_Interrupt();
+    Event_Flags=Event->Flags;
+    if((Flags==0)||(_Sys_Event_Match(Event_Flags,Flags,Opt)==0))
+    {
+        Sys_Unlock_Interrupt();
+        return 0;
+    }
+    
+    if((Opt&EVENT_CLEAR)!=0)
+        Event->Flags&=~Flags;
+    Sys_Unlock_Interrupt();
+    return Event_Flags;
+}
+#endif
+/* End Function:Sys_Event_Try_Wait *******************************************/
+
+/* Begin Function:Sys_Event_Wait **********************************************
+Description : Wait until any or all of some flags of an event are set. If they
+              are not yet, the current thread waits until a Sys_Event_Set 
+              satisfies it. The "Init" thread cannot wait.
+Input       : struct Event xdata* Event - The event flag group.
+              flag_t Flags - The flags to wait for.
+              u8 Opt - EVENT_ANY or EVENT_ALL, maybe with EVENT_CLEAR.
+Output      : None.
+Return      : flag_t - The flags of the event when the wait was satisfied, before
+                       any clearing. If the thread cannot wait, or the wait ended
+                       otherwise, 0.
+******************************************************************************/
+#if(ENABLE_EVENT==TRUE)
+flag_t Sys_Event_Wait(struct Event xdata* Event,flag_t Flags,u8 Opt)
+{
+    tid_t TID=Current_TID;
+    flag_t Event_Flags;
+    
+    if(Flags==0)
+        return 0;
+    
+    Sys_Lock_Interrupt();
+    Event_Flags=Event->Flags;
+    if(_Sys_Event_Match(Event_Flags,Flags,Opt)!=0)
+    {
+        if((Opt&EVENT_CLEAR)!=0)
+            Event->Flags&=~Flags;
+        Sys_Unlock_Interrupt();
+        return Event_Flags;
+    }
+    
+    if(TID==0)
+    {
+        Sys_Unlock_Interrupt();
+        return 0;
+    }
+    
+    TCB[TID].Wait_Flags=Flags;
+    TCB[TID].Wait_Opt=Opt;
+    if(_Sys_Wait(&Event->Wait_List)==0)
+    {
+        Sys_Unlock_Interrupt();
+        return 0;
+    }
+    Event_Flags=TCB[TID].Wait_Flags;
+    Sys_Unlock_Interrupt();
+    return Event_Flags;
+}
+#endif
+/* End Function:Sys_Event_Wait ***********************************************/
+
+/*---------------------------- Trace Module -----------------------------------
+The trace module records what the scheduler does, to find out which thread runs
+when and which one takes the CPU time:
+1> The context switches, signal sends, thread kills and allocations are written 
+   to Sys_Trace, a ring that keeps the last TRACE_SIZE of them. Each record has
+   a 32-bit timestamp, the type, and the TIDs and arguments involved.
+2> Each context switch also adds the time that the thread has just run to its
+   Run_Time, which adds up for as long as the thread lives.
+To read the trace, halt the board, dump the bytes of Sys_Trace to a file, and
+run Tools/Trace on it. It prints the records in order, and how much of the time
+that they cover each thread has run.
+-----------------------------------------------------------------------------*/
 
-    switch(Signal)
-    {
-        /* Other signals and non-signal patterns cannot be registered a handler */        
-        case SIGUSR1:TCB[TID].Signal_Handler[0]=(ptr_int_t)Signal_Handler;break;
-        case SIGUSR2:TCB[TID].Signal_Handler[1]=(ptr_int_t)Signal_Handler;break;
-        case SIGUSR3:TCB[TID].Signal_Handler[2]=(ptr_int_t)Signal_Handler;break;
-        case SIGUSR4:TCB[TID].Signal_Handler[3]=(ptr_int_t)Signal_Handler;break;
+/* Begin Function:_Sys_Trace **************************************************
+Description : Write a trace record, over the oldest one if the ring is full. 
+              The caller holds the lock.
+Input       : u8 Type - The record type.
+              tid_t TID - The thread the record is about.
+              u8 Arg1 - The first argument, depending on the type.
+              u8 Arg2 - The second argument, depending on the type.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_TRACE==TRUE)
+void _Sys_Trace(u8 Type,tid_t TID,u8 Arg1,u8 Arg2)
+{
+    struct Trace_Rec xdata* Rec;
+    u32 Now;
+    
+    Now=_Sys_Trace_Time();
+    Rec=&Sys_Trace.Rec[Sys_Trace.Head];
+    Rec->Type=Type;
+    Rec->TID=TID;
+    Rec->Arg1=Arg1;
+    Rec->Arg2=Arg2;
+    Rec->Time[0]=Now>>24;
+    Rec->Time[1]=Now>>16;
+    Rec->Time[2]=Now>>8;
+    Rec->Time[3]=Now;
+    
+    Sys_Trace.Head=(Sys_Trace.Head+1)&(TRACE_SIZE-1);
+    if(Sys_Trace.Head==0)
+        Sys_Trace.Wrapped=1;
+}
+#endif
+/* End Function:_Sys_Trace ***************************************************/
 
-        /* The input is not a signal */
-        default:return -1;
-    }    
-    return 0;
+/* Begin Function:Sys_Trace_Clear *********************************************
+Description : Throw away all trace records, so that the next dump only has what
+              happens from now on. The run times of the threads are kept.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_TRACE==TRUE)
+void Sys_Trace_Clear(void)
+{
+    Sys_Lock_Interrupt();
+    Sys_Trace.Head=0;
+    Sys_Trace.Wrapped=0;
+    Sys_Unlock_Interrupt();
 }
-/* End Function:Sys_Register_Signal_Handler **********************************/
+#endif
+/* End Function:Sys_Trace_Clear **********************************************/
+
+/* Begin Function:Sys_Get_Run_Time ********************************************
+Description : Get how long a thread has run since it was started. For the 
+              calling thread, this counts up to now.
+Input       : tid_t TID - The thread ID.
+Output      : None.
+Return      : u32 - The run time, in trace time units: machine cycles on the 
+                    8051. If the thread does not exist, 0.
+******************************************************************************/
+#if(ENABLE_TRACE==TRUE)
+u32 Sys_Get_Run_Time(tid_t TID)
+{
+    u32 Run_Time;
+    
+    if((TID<0)||(TID>=MAX_THREADS)||((TCB_Status[TID]&OCCUPY)==0))
+        return 0;
+    
+    Sys_Lock_Interrupt();
+    Run_Time=TCB[TID].Run_Time;
+    if(TID==Current_TID)
+        Run_Time+=_Sys_Trace_Time()-Sys_Trace_Switch_Time;
+    Sys_Unlock_Interrupt();
+    
+    return Run_Time;
+}
+#endif
+/* End Function:Sys_Get_Run_Time *********************************************/
 
 /*--------------------------- Memory Management -------------------------------
 The memory management module utilize the paging method. When you allocate memory,
-the minimum amount allocated is 2 pages - Why is that? See the description below.
+the amount allocated is rounded up to whole pages.
 Assume we have a memory region (1K) as follows, divided into 20 pages, the Mem_CB is:
 0x0000 [0][0][0][0][0] [0][0][0][0][0] [0][0][0][0][0] [0][0][0][0][0] 0x03FF
 
-When the thread A (TID=1) want to allocate 200 bytes of memory, the Mem_CB becomes:
+When the thread A (TID=1) want to allocate 150 bytes of memory, the Mem_CB becomes:
 0x0000 [1][1][1][0][0] [0][0][0][0][0] [0][0][0][0][0] [0][0][0][0][0] 0x03FF
 Here we can see 3 slots are filled by "1". The "1" means that the corresponding 
-memory area is assigned to the thread A. However, there is a single block marked
-"0" after the "1"s, and this block is also assigned to the thread A. Why do we need this?
+memory area is assigned to the thread A.
 
 When the thread A allocates memory(100 bytes) again:
-0x0000 [1][1][1][0][1] [0][0][0][0][0] [0][0][0][0][0] [0][0][0][0][0] 0x03FF
+0x0000 [1][1][1][1][1] [0][0][0][0][0] [0][0][0][0][0] [0][0][0][0][0] 0x03FF
+       ^        ^
        ************=======
            A.1st    A.2nd
-This means that the thread A has allocated the memory twice. The "0" acted as a
-segregation marker between the two allocations.
+This means that the thread A has allocated the memory twice. The two allocations
+sit next to each other: where each of them starts (marked "^") is recorded in 
+a separate start bitmap, one bit per page, so no page is wasted on a marker. A
+free must point at a page whose start bit is set and which belongs to the thread.
 
-Now the thread B (TID=2) want to allocate 1K bytes of memory. The Mem_CB is:
-0x0000 [1][1][1][0][1] [0][2][2][2][2] [2][2][2][2][2] [0][0][0][0][0] 0x03FF
-       ************=======++++++++++++++++++++++++++++++++
-           A.1st    A.2nd              B.1st           
+Now the thread B (TID=2) want to allocate 750 bytes of memory. The Mem_CB is:
+0x0000 [1][1][1][1][1] [2][2][2][2][2] [2][2][2][2][2] [2][2][2][2][2] 0x03FF
+       ************=======++++++++++++++++++++++++++++++++++++++++++++
+           A.1st    A.2nd                      B.1st           
            
-The simple memory control block works as the above desctiption. The memory allocator
-is simple in both space and time (when managing a small memory region).
+The simple memory control block works as the above desctiption. To keep the 
+allocator fast when there are many pages, the runs of pages are also indexed:
+1> Each free run has its length recorded at its first and last page, and is put
+   in the free list. Allocation searches the free runs only, and freeing merges
+   with the neighbouring free runs at once.
+2> Each allocated block has its length recorded at its first page, and is put in
+   the block list of its thread. Freeing all memory of a thread only visits the
+   blocks of that thread.
+3> A bitmap tells which pages are free, so that "0" in Mem_CB is not relied on.
+Over time, the free pages may be scattered in runs too small for any request. 
+Blocks allocated through handles (ENABLE_MEM_HANDLE) can then be slid towards
+the start of the heap to merge the free runs. The application keeps a handle, 
+which is the kernel's pointer to the block, and reads the block through it every
+time, never keeping "*Handle" across a call into the kernel or a switch.
+For many allocations of the same size, a pool of fixed-size blocks can be carved
+from the heap instead (ENABLE_MEM_POOL). Its free blocks are linked through their
+own memory, so allocating and freeing a block takes constant time. Each block
+starts with the TID of its user, which is checked on free just like Mem_CB, and
+lets the blocks of a killed thread be found in every pool and freed.
 -----------------------------------------------------------------------------*/
 
-/* Begin Function:_Sys_Memory_Init ********************************************
-Description : Initialize the system memory management module. The Memory module
-              uses paging memory pool method to manage a very limited amount of
-              memory.
+/* Test, set and clear the free bit of a page */
+#define MEM_IS_FREE(PAGE)       ((Mem.Mem_Free[(PAGE)>>3]&(1<<((PAGE)&0x07)))!=0)
+#define MEM_SET_FREE(PAGE)      Mem.Mem_Free[(PAGE)>>3]|=(1<<((PAGE)&0x07))
+#define MEM_CLR_FREE(PAGE)      Mem.Mem_Free[(PAGE)>>3]&=~(1<<((PAGE)&0x07))
+/* Test, set and clear the start bit of a page */
+#define MEM_IS_START(PAGE)      ((Mem.Mem_Start[(PAGE)>>3]&(1<<((PAGE)&0x07)))!=0)
+#define MEM_SET_START(PAGE)     Mem.Mem_Start[(PAGE)>>3]|=(1<<((PAGE)&0x07))
+#define MEM_CLR_START(PAGE)     Mem.Mem_Start[(PAGE)>>3]&=~(1<<((PAGE)&0x07))
+/* Test, set and clear the movable bit of a block */
+#define MEM_IS_MOVE(PAGE)       ((Mem.Mem_Move[(PAGE)>>3]&(1<<((PAGE)&0x07)))!=0)
+#define MEM_SET_MOVE(PAGE)      Mem.Mem_Move[(PAGE)>>3]|=(1<<((PAGE)&0x07))
+#define MEM_CLR_MOVE(PAGE)      Mem.Mem_Move[(PAGE)>>3]&=~(1<<((PAGE)&0x07))
+
+/* Begin Function:_Sys_Memory_Init ********************************************
+Description : Initialize the system memory management module. The Memory module
+              uses paging memory pool method to manage a very limited amount of
+              memory.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _Sys_Memory_Init(void)
+{   
+#if(ENABLE_MEMM==TRUE) 
+    cnt_t TID_Cnt;
+    
+    Sys_Memset_Xdata(&Mem,0,sizeof(struct Memory));
+    
+    /* No thread has any blocks, nor has the kernel */
+    for(TID_Cnt=0;TID_Cnt<=MEM_KERNEL;TID_Cnt++)
+        Mem.Mem_Block_Head[TID_Cnt]=MEM_NIL;
+    
+    /* The whole heap is one free run */
+    Mem.Mem_Free_Head=MEM_NIL;
+    _Sys_Mem_Add_Free(0,DMEM_PAGES);
+#endif
+#if(ENABLE_MEM_POOL==TRUE)
+    Mem_Pool_List=0;
+#endif
+}
+/* End Function:_Sys_Memory_Init *********************************************/
+
+/* Begin Function:_Sys_Mem_Link ***********************************************
+Description : Put a run at the head of a run list - the free list, or a thread's
+              block list. The runs are linked by their first pages.
+Input       : page_t xdata* Head - The list head.
+              page_t Page - The first page of the run.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void _Sys_Mem_Link(page_t xdata* Head,page_t Page)
+{
+    Mem.Mem_Prev[Page]=MEM_NIL;
+    Mem.Mem_Next[Page]=*Head;
+    if(*Head!=MEM_NIL)
+        Mem.Mem_Prev[*Head]=Page;
+    *Head=Page;
+}
+#endif
+/* End Function:_Sys_Mem_Link ************************************************/
+
+/* Begin Function:_Sys_Mem_Unlink *********************************************
+Description : Take a run out of a run list.
+Input       : page_t xdata* Head - The list head.
+              page_t Page - The first page of the run.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void _Sys_Mem_Unlink(page_t xdata* Head,page_t Page)
+{
+    if(Mem.Mem_Prev[Page]==MEM_NIL)
+        *Head=Mem.Mem_Next[Page];
+    else
+        Mem.Mem_Next[Mem.Mem_Prev[Page]]=Mem.Mem_Next[Page];
+    
+    if(Mem.Mem_Next[Page]!=MEM_NIL)
+        Mem.Mem_Prev[Mem.Mem_Next[Page]]=Mem.Mem_Prev[Page];
+}
+#endif
+/* End Function:_Sys_Mem_Unlink **********************************************/
+
+/* Begin Function:_Sys_Mem_Add_Free *******************************************
+Description : Make a run of pages free and put it into the free list. The pages
+              must not be part of any other run, and the pages around the run 
+              must not be free.
+Input       : page_t Page - The first page of the run.
+              page_t Pages - The length of the run.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void _Sys_Mem_Add_Free(page_t Page,page_t Pages)
+{
+    page_t Page_Cnt;
+    
+    for(Page_Cnt=Page;Page_Cnt<Page+Pages;Page_Cnt++)
+        MEM_SET_FREE(Page_Cnt);
+    
+    /* The length at both ends, so that a neighbour from either side can merge */
+    Mem.Mem_Len[Page]=Pages;
+    Mem.Mem_Len[Page+Pages-1]=Pages;
+    _Sys_Mem_Link(&Mem.Mem_Free_Head,Page);
+}
+#endif
+/* End Function:_Sys_Mem_Add_Free ********************************************/
+
+/* Begin Function:_Sys_Mem_Merge_Free *****************************************
+Description : Make a run of pages free, merging it with the free runs on both 
+              sides. The pages must not be part of any other run. The caller 
+              holds the lock.
+Input       : page_t Page - The first page of the run.
+              page_t Pages - The length of the run.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void _Sys_Mem_Merge_Free(page_t Page,page_t Pages)
+{
+    page_t Page_Cnt;
+    
+    for(Page_Cnt=Page;Page_Cnt<Page+Pages;Page_Cnt++)
+        Mem.Mem_CB[Page_Cnt]=0;
+    
+    /* Merge with the free run after it */
+    if((Page+Pages<DMEM_PAGES)&&(MEM_IS_FREE(Page+Pages)))
+    {
+        _Sys_Mem_Unlink(&Mem.Mem_Free_Head,Page+Pages);
+        Pages+=Mem.Mem_Len[Page+Pages];
+    }
+    /* Merge with the free run before it */
+    if((Page>0)&&(MEM_IS_FREE(Page-1)))
+    {
+        Page_Cnt=Mem.Mem_Len[Page-1];
+        Page-=Page_Cnt;
+        Pages+=Page_Cnt;
+        _Sys_Mem_Unlink(&Mem.Mem_Free_Head,Page);
+    }
+    
+    _Sys_Mem_Add_Free(Page,Pages);
+}
+#endif
+/* End Function:_Sys_Mem_Merge_Free ******************************************/
+
+/* Begin Function:_Sys_Mem_Release ********************************************
+Description : Return an allocated block to the free list. The caller holds the
+              lock.
+Input       : tid_t TID - The owner of the block.
+              page_t Page - The first page of the block.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void _Sys_Mem_Release(tid_t TID,page_t Page)
+{
+#if(ENABLE_MEM_HANDLE==TRUE)
+    cnt_t Handle_Cnt;
+    
+    /* A movable block also gives up its handle */
+    if(MEM_IS_MOVE(Page))
+    {
+        MEM_CLR_MOVE(Page);
+        for(Handle_Cnt=0;Handle_Cnt<MEM_HANDLES;Handle_Cnt++)
+        {
+            if(Mem.Mem_Handle[Handle_Cnt]==&Mem.DMEM_Heap[Page*PAGE_SIZE])
+                Mem.Mem_Handle[Handle_Cnt]=0;
+        }
+    }
+    /* There may be something to compact now */
+    Mem.Mem_Compact_Pend=1;
+#endif
+    _Sys_Mem_Unlink(&Mem.Mem_Block_Head[TID],Page);
+    MEM_CLR_START(Page);
+    _Sys_Mem_Merge_Free(Page,Mem.Mem_Len[Page]);
+}
+#endif
+/* End Function:_Sys_Mem_Release *********************************************/
+
+/* Begin Function:_Sys_Mem_Get_Block ******************************************
+Description : Find the block that a pointer from __Sys_Malloc refers to. The 
+              pointer must be the start of a block, and the block must belong 
+              to the thread. The caller holds the lock.
+Input       : tid_t TID - The thread ID.
+              void xdata* Mem_Ptr - The pointer.
+Output      : None.
+Return      : page_t - The first page of the block. If the pointer is not valid,
+                       MEM_NIL.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+page_t _Sys_Mem_Get_Block(tid_t TID,void xdata* Mem_Ptr)
+{
+    ptr_int_t Offset;
+    
+    /* See if the pointer is valid - A valid pointer must not be null and point
+     * to the start address of a certain memory page.
+     */
+    Offset=(ptr_int_t)((u8 xdata*)Mem_Ptr-(Mem.DMEM_Heap));
+    if((Mem_Ptr==0)||(Offset%PAGE_SIZE!=0)||(Offset/PAGE_SIZE>=DMEM_PAGES))
+        return MEM_NIL;
+    
+    /* See if this memory region can be freed by this thread - it must be the
+     * start of a block, and the block must be this thread's.
+     */
+    if((MEM_IS_START(Offset/PAGE_SIZE)==0)||(Mem.Mem_CB[Offset/PAGE_SIZE]!=TID))
+        return MEM_NIL;
+    
+    return (page_t)(Offset/PAGE_SIZE);
+}
+#endif
+/* End Function:_Sys_Mem_Get_Block *******************************************/
+
+/* Begin Function:_Sys_Mem_Give ***********************************************
+Description : Give a block from __Sys_Malloc to another thread, whoever owns it
+              now, so that the new owner can free it. Pointers that are not the
+              start of an allocated block are left alone. The caller holds the lock.
+Input       : tid_t TID - The new owner.
+              void xdata* Mem_Ptr - The pointer.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void _Sys_Mem_Give(tid_t TID,void xdata* Mem_Ptr)
+{
+    ptr_int_t Offset;
+    page_t Page;
+    page_t Page_Cnt;
+    tid_t Owner;
+    
+    Offset=(ptr_int_t)((u8 xdata*)Mem_Ptr-(Mem.DMEM_Heap));
+    if((Mem_Ptr==0)||(Offset%PAGE_SIZE!=0)||(Offset/PAGE_SIZE>=DMEM_PAGES))
+        return;
+    Page=(page_t)(Offset/PAGE_SIZE);
+    if(MEM_IS_START(Page)==0)
+        return;
+    
+    Owner=Mem.Mem_CB[Page];
+    if(Owner==TID)
+        return;
+    
+    _Sys_Mem_Unlink(&Mem.Mem_Block_Head[Owner],Page);
+    for(Page_Cnt=Page;Page_Cnt<Page+Mem.Mem_Len[Page];Page_Cnt++)
+        Mem.Mem_CB[Page_Cnt]=TID;
+    _Sys_Mem_Link(&Mem.Mem_Block_Head[TID],Page);
+}
+#endif
+/* End Function:_Sys_Mem_Give ************************************************/
+
+/* Begin Function:__Sys_Malloc ************************************************
+Description : Allocate some memory in the name of a certain thread. This function
+              will not check if the TID is valid. The time taken is bounded by
+              the number of free runs, not by the heap size.
+Input       : tid_t - The thread ID, or MEM_KERNEL.
+              size_t Bytes - The amount of RAM that the application need.
+Output      : None.
+Return      : void xdata* - The pointer to the memory. If the function fails, it will
+                            return 0.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void xdata* __Sys_Malloc(tid_t TID,size_t Size)
+{    
+    page_t Page;
+    page_t Page_Cnt;
+    cnt_t Total_Pages;
+    
+    /* See if the size is valid */
+    if(Size==0)
+        return ((void*)0);
+    
+    /* See if the TID is valid in the system. The kernel has blocks too */   
+    if(TID>MEM_KERNEL)
+        return ((void*)0);
+    
+    /* Decide how many pages to allocate */
+    if(Size%PAGE_SIZE==0)
+        Total_Pages=Size/PAGE_SIZE;
+    else
+        Total_Pages=Size/PAGE_SIZE+1;
+    if(Total_Pages>DMEM_PAGES)
+        return ((void*)0);
+    
+    /* Threads may be preempted while allocating */
+    Sys_Lock_Interrupt();
+
+    /* Find the first free run that is large enough */
+    Page=Mem.Mem_Free_Head;
+    while(Page!=MEM_NIL)
+    {
+        if(Mem.Mem_Len[Page]>=Total_Pages)
+            break;
+        Page=Mem.Mem_Next[Page];
+    }
+    
+#if(ENABLE_MEM_HANDLE==TRUE)
+    /* If nothing fits, compact the whole heap and look again. Compaction slides
+     * the blocks down, so a fit can only be at the last free run.
+     */
+    if((Page==MEM_NIL)&&(Mem.Mem_Compact_Pend!=0))
+    {
+        Sys_Unlock_Interrupt();
+        Sys_Mem_Compact(DMEM_SIZE);
+        Sys_Lock_Interrupt();
+        
+        Page=Mem.Mem_Free_Head;
+        while(Page!=MEM_NIL)
+        {
+            if(Mem.Mem_Len[Page]>=Total_Pages)
+                break;
+            Page=Mem.Mem_Next[Page];
+        }
+    }
+#endif
+
+#if(ENABLE_TRACE==TRUE)
+    _Sys_Trace(TRACE_MALLOC,TID,Page,Total_Pages);
+#endif
+    /* See if we have found any */
+    if(Page==MEM_NIL)
+    {
+        Sys_Unlock_Interrupt();
+        return ((void*)0);
+    }
+    
+    /* Take the block from the head of the run, and give back the rest */
+    _Sys_Mem_Unlink(&Mem.Mem_Free_Head,Page);
+    if(Mem.Mem_Len[Page]>Total_Pages)
+        _Sys_Mem_Add_Free(Page+Total_Pages,Mem.Mem_Len[Page]-Total_Pages);
+    
+    for(Page_Cnt=Page;Page_Cnt<Page+Total_Pages;Page_Cnt++)
+    {
+        MEM_CLR_FREE(Page_Cnt);
+        Mem.Mem_CB[Page_Cnt]=TID;
+    }
+    MEM_SET_START(Page);
+    Mem.Mem_Len[Page]=Total_Pages;
+    _Sys_Mem_Link(&Mem.Mem_Block_Head[TID],Page);
+    
+    Sys_Unlock_Interrupt();
+    return (void xdata*)(&Mem.DMEM_Heap[Page*PAGE_SIZE]);		
+}
+#endif
+/* End Function:_Sys_Malloc **************************************************/
+
+/* Begin Function:Sys_Malloc **************************************************
+Description : Allocate some memory. For application use.
+Input       : size_t Bytes - The amount of RAM that the application need.
+Output      : None.
+Return      : void xdata* - The pointer to the memory. If the function fails, it will
+                            return 0.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void xdata* Sys_Malloc(size_t Size)
+{    
+    return __Sys_Malloc(Current_TID,Size);
+}
+#endif
+/* End Function:Sys_Malloc ***************************************************/
+
+/* Begin Function:__Sys_Mfree *************************************************
+Description : Free the allocated memory. In the name of a certain thread.
+Input       : tid_t - The thread ID, or MEM_KERNEL.
+              void xdata* Mem_Ptr - The pointer to the memory region that you want to free.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void __Sys_Mfree(tid_t TID,void xdata* Mem_Ptr)
+{    
+    page_t Page;
+    
+    /* See if the TID is valid in the system. The kernel has blocks too */   
+    if(TID>MEM_KERNEL)
+        return;
+    
+    Sys_Lock_Interrupt();
+    
+    Page=_Sys_Mem_Get_Block(TID,Mem_Ptr);
+    if(Page==MEM_NIL)
+    {
+        Sys_Unlock_Interrupt();
+        return;
+    }
+#if(ENABLE_MEM_HANDLE==TRUE)
+    /* Movable blocks are freed through their handles */
+    if(MEM_IS_MOVE(Page))
+    {
+        Sys_Unlock_Interrupt();
+        return;
+    }
+#endif
+    
+    /* Mark the area as free */
+    _Sys_Mem_Release(TID,Page);
+    
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:__Sys_Mfree **************************************************/
+
+/* Begin Function:Sys_Mfree ***************************************************
+Description : Free the allocated memory. For application use.
+Input       : void xdata* Mem_Ptr -The pointer to the memory region that you want to free.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void Sys_Mfree(void xdata* Mem_Ptr)
+{    
+    __Sys_Mfree(Current_TID,Mem_Ptr);
+}
+#endif
+/* End Function:Sys_Mfree ****************************************************/
+
+/* Begin Function:__Sys_Mfree_All *********************************************
+Description : Free all allocated memory of a certain thread. The time taken is
+              bounded by the number of blocks the thread has.
+Input       : tid_t - The thread ID.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEMM==TRUE)
+void __Sys_Mfree_All(tid_t TID)
+{    
+    /* See if the TID is valid in the system */   
+    if(TID>=MAX_THREADS)
+        return;
+    
+    /* Release the blocks of the thread one by one */
+    Sys_Lock_Interrupt();
+    while(Mem.Mem_Block_Head[TID]!=MEM_NIL)
+        _Sys_Mem_Release(TID,Mem.Mem_Block_Head[TID]);
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:__Sys_Mfree_All **********************************************/
+
+/* Begin Function:Sys_Mfree_All ***********************************************
+Description : Free all allocated memory.
 Input       : None.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-void _Sys_Memory_Init(void)
-{   
-#if(ENABLE_MEMM==TRUE) 
-    Sys_Memset((ptr_int_t)(&Mem),0,sizeof(struct Memory));
-#endif
+#if(ENABLE_MEMM==TRUE)
+void Sys_Mfree_All(void)
+{    
+    __Sys_Mfree_All(Current_TID);
 }
-/* End Function:_Sys_Memory_Init *********************************************/
+#endif
+/* End Function:Sys_Mfree_All ************************************************/
 
-/* Begin Function:__Sys_Malloc ************************************************
-Description : Allocate some memory in the name of a certain thread. This function
-              will not check if the TID is valid.
+/* Begin Function:__Sys_Realloc ***********************************************
+Description : Change the size of an allocated block, in the name of a certain 
+              thread. A block shrinks in place, and grows in place when the pages
+              after it are free; only otherwise is it moved, copying the old 
+              contents. 
 Input       : tid_t - The thread ID.
-              size_t Bytes - The amount of RAM that the application need.
+              void xdata* Mem_Ptr - The block. If 0, this is __Sys_Malloc.
+              size_t Size - The new size. If 0, this is __Sys_Mfree.
 Output      : None.
-Return      : void xdata* - The pointer to the memory. If the function fails, it will
-                            return 0.
+Return      : void xdata* - The pointer to the block, which may have moved. If 
+                            the function fails, it will return 0, and the old
+                            block is left as it was.
 ******************************************************************************/
 #if(ENABLE_MEMM==TRUE)
-void xdata* __Sys_Malloc(tid_t TID,size_t Size)
-{    
-    cnt_t Mem_Page_Cnt;
-    cnt_t Page_Amount_Cnt;
+void xdata* __Sys_Realloc(tid_t TID,void xdata* Mem_Ptr,size_t Size)
+{
+    page_t Page;
+    page_t Pages;
+    page_t Next;
+    page_t Page_Cnt;
     cnt_t Total_Pages;
-    s8 Find_Flag=0;
+    void xdata* New_Ptr;
     
-    /* See if the size is valid */
+    if(Mem_Ptr==0)
+        return __Sys_Malloc(TID,Size);
     if(Size==0)
+    {
+        __Sys_Mfree(TID,Mem_Ptr);
         return ((void*)0);
+    }
     
     /* See if the TID is valid in the system */   
     if(TID>=MAX_THREADS)
         return ((void*)0);
     
-    /* Decide how many pages to allocate */
+    /* Decide how many pages are needed */
     if(Size%PAGE_SIZE==0)
         Total_Pages=Size/PAGE_SIZE;
     else
         Total_Pages=Size/PAGE_SIZE+1;
+    if(Total_Pages>DMEM_PAGES)
+        return ((void*)0);
     
-    Page_Amount_Cnt=0;
-
-    /* Try to find continuous page to allocate */
-    for(Mem_Page_Cnt=0;Mem_Page_Cnt<DMEM_PAGES;Mem_Page_Cnt++)
+    Sys_Lock_Interrupt();
+    
+    Page=_Sys_Mem_Get_Block(TID,Mem_Ptr);
+    if(Page==MEM_NIL)
     {
-        if(Mem.Mem_CB[Mem_Page_Cnt]==0)
-            Page_Amount_Cnt++;
-        else
-            Page_Amount_Cnt=0;
-        
-        if(Page_Amount_Cnt==Total_Pages)
-        {
-            Find_Flag=1;
-            break;
-        }
+        Sys_Unlock_Interrupt();
+        return ((void*)0);
     }
-
-    /* See if we have found any */
-    if(Find_Flag==0)
+#if(ENABLE_MEM_HANDLE==TRUE)
+    /* Movable blocks have a handle that would go stale */
+    if(MEM_IS_MOVE(Page))
+    {
+        Sys_Unlock_Interrupt();
         return ((void*)0);
+    }
+#endif
+    Pages=Mem.Mem_Len[Page];
     
-    /* If the page amount is 1, use special method */
-    if(Page_Amount_Cnt==1)
+    /* Shrink in place: the tail goes back to the free list */
+    if(Total_Pages<=Pages)
     {
-        Mem.Mem_CB[Mem_Page_Cnt]=TID; 
+        if(Total_Pages<Pages)
+        {
+            Mem.Mem_Len[Page]=Total_Pages;
+            _Sys_Mem_Merge_Free(Page+Total_Pages,Pages-Total_Pages);
+        }
+        Sys_Unlock_Interrupt();
+        return Mem_Ptr;
     }
-    else
+    
+    /* Grow in place, if the free run after the block is large enough */
+    Next=Page+Pages;
+    if((Next<DMEM_PAGES)&&(MEM_IS_FREE(Next))&&(Mem.Mem_Len[Next]>=Total_Pages-Pages))
     {
-        for(Page_Amount_Cnt--;Page_Amount_Cnt>0;Page_Amount_Cnt--)
+        _Sys_Mem_Unlink(&Mem.Mem_Free_Head,Next);
+        if(Mem.Mem_Len[Next]>Total_Pages-Pages)
+            _Sys_Mem_Add_Free(Page+Total_Pages,Mem.Mem_Len[Next]-(Total_Pages-Pages));
+        
+        for(Page_Cnt=Next;Page_Cnt<Page+Total_Pages;Page_Cnt++)
         {
-            Mem_Page_Cnt--;
-            Mem.Mem_CB[Mem_Page_Cnt]=TID;   
+            MEM_CLR_FREE(Page_Cnt);
+            Mem.Mem_CB[Page_Cnt]=TID;
         }
+        Mem.Mem_Len[Page]=Total_Pages;
+        Sys_Unlock_Interrupt();
+        return Mem_Ptr;
     }
-    /* Now the pointer must have rewinded to the start address */
-    return (void xdata*)(&Mem.DMEM_Heap[Mem_Page_Cnt*PAGE_SIZE]);		
+    Sys_Unlock_Interrupt();
+    
+    /* Move it. The old block stays ours until the copy is done */
+    New_Ptr=__Sys_Malloc(TID,Size);
+    if(New_Ptr==0)
+        return ((void*)0);
+    Sys_Memcpy_Xdata(New_Ptr,Mem_Ptr,Pages*PAGE_SIZE);
+    __Sys_Mfree(TID,Mem_Ptr);
+    
+    return New_Ptr;
 }
 #endif
-/* End Function:_Sys_Malloc **************************************************/
+/* End Function:__Sys_Realloc ************************************************/
 
-/* Begin Function:Sys_Malloc **************************************************
-Description : Allocate some memory. For application use.
-Input       : size_t Bytes - The amount of RAM that the application need.
+/* Begin Function:Sys_Realloc *************************************************
+Description : Change the size of an allocated block. For application use.
+Input       : void xdata* Mem_Ptr - The block. If 0, this is Sys_Malloc.
+              size_t Size - The new size. If 0, this is Sys_Mfree.
 Output      : None.
-Return      : void xdata* - The pointer to the memory. If the function fails, it will
-                            return 0.
+Return      : void xdata* - The pointer to the block, which may have moved. If 
+                            the function fails, it will return 0, and the old
+                            block is left as it was.
 ******************************************************************************/
 #if(ENABLE_MEMM==TRUE)
-void xdata* Sys_Malloc(size_t Size)
-{    
-    return __Sys_Malloc(Current_TID,Size);
+void xdata* Sys_Realloc(void xdata* Mem_Ptr,size_t Size)
+{
+    return __Sys_Realloc(Current_TID,Mem_Ptr,Size);
 }
 #endif
-/* End Function:Sys_Malloc ***************************************************/
+/* End Function:Sys_Realloc **************************************************/
 
-/* Begin Function:__Sys_Mfree *************************************************
-Description : Free the allocated memory. In the name of a certain thread.
-Input       : tid_t - The thread ID.
-              void xdata* Mem_Ptr - The pointer to the memory region that you want to free.
+/* Begin Function:__Sys_Handle_Alloc ******************************************
+Description : Allocate a movable block in the name of a certain thread. The 
+              block is reached through the returned handle, as "*Handle", 
+              which the compaction rewrites whenever it moves the block.
+Input       : tid_t TID - The thread ID.
+              size_t Size - The amount of RAM that the application need.
+Output      : None.
+Return      : handle_t - The handle. If the function fails, it will return 0.
+******************************************************************************/
+#if(ENABLE_MEM_HANDLE==TRUE)
+handle_t __Sys_Handle_Alloc(tid_t TID,size_t Size)
+{
+    cnt_t Handle_Cnt;
+    void xdata* Mem_Ptr;
+    
+    /* Find a free handle first */
+    Sys_Lock_Interrupt();
+    for(Handle_Cnt=0;Handle_Cnt<MEM_HANDLES;Handle_Cnt++)
+    {
+        if(Mem.Mem_Handle[Handle_Cnt]==0)
+            break;
+    }
+    if(Handle_Cnt==MEM_HANDLES)
+    {
+        Sys_Unlock_Interrupt();
+        return ((handle_t)0);
+    }
+    
+    /* The lock is held through the allocation, so nobody takes the handle */
+    Mem_Ptr=__Sys_Malloc(TID,Size);
+    if(Mem_Ptr==0)
+    {
+        Sys_Unlock_Interrupt();
+        return ((handle_t)0);
+    }
+    
+    MEM_SET_MOVE(((u8 xdata*)Mem_Ptr-Mem.DMEM_Heap)/PAGE_SIZE);
+    Mem.Mem_Handle[Handle_Cnt]=Mem_Ptr;
+    Sys_Unlock_Interrupt();
+    
+    return &Mem.Mem_Handle[Handle_Cnt];
+}
+#endif
+/* End Function:__Sys_Handle_Alloc *******************************************/
+
+/* Begin Function:Sys_Handle_Alloc ********************************************
+Description : Allocate a movable block. For application use.
+Input       : size_t Size - The amount of RAM that the application need.
+Output      : None.
+Return      : handle_t - The handle. If the function fails, it will return 0.
+******************************************************************************/
+#if(ENABLE_MEM_HANDLE==TRUE)
+handle_t Sys_Handle_Alloc(size_t Size)
+{
+    return __Sys_Handle_Alloc(Current_TID,Size);
+}
+#endif
+/* End Function:Sys_Handle_Alloc *********************************************/
+
+/* Begin Function:__Sys_Handle_Free *******************************************
+Description : Free a movable block and its handle, in the name of a certain thread.
+Input       : tid_t TID - The thread ID.
+              handle_t Handle - The handle.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-#if(ENABLE_MEMM==TRUE)
-void __Sys_Mfree(tid_t TID,void xdata* Mem_Ptr)
-{    
-    cnt_t Page_Cnt;
+#if(ENABLE_MEM_HANDLE==TRUE)
+void __Sys_Handle_Free(tid_t TID,handle_t Handle)
+{
+    page_t Page;
     
-    /* See if the pointer is valid - A valid pointer must not be null and point
-     * to the start address of a certain memory page.
-     */
-    if((Mem_Ptr==0)||((ptr_int_t)(Mem_Ptr-(Mem.DMEM_Heap)))%PAGE_SIZE!=0)
+    /* See if the handle is one of ours */
+    if((Handle<&Mem.Mem_Handle[0])||(Handle>=&Mem.Mem_Handle[MEM_HANDLES]))
         return;
-    
-    /* See if the TID is valid in the system */   
     if(TID>=MAX_THREADS)
         return;
     
-    /* Calculate which page it is in */
-    Page_Cnt=(cnt_t)(((ptr_int_t)(Mem_Ptr-(Mem.DMEM_Heap)))/PAGE_SIZE);
+    Sys_Lock_Interrupt();
+    Page=_Sys_Mem_Get_Block(TID,*Handle);
+    if((Page!=MEM_NIL)&&(MEM_IS_MOVE(Page)))
+        _Sys_Mem_Release(TID,Page);
+    Sys_Unlock_Interrupt();
+}
+#endif
+/* End Function:__Sys_Handle_Free ********************************************/
+
+/* Begin Function:Sys_Handle_Free *********************************************
+Description : Free a movable block and its handle. For application use.
+Input       : handle_t Handle - The handle.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEM_HANDLE==TRUE)
+void Sys_Handle_Free(handle_t Handle)
+{
+    __Sys_Handle_Free(Current_TID,Handle);
+}
+#endif
+/* End Function:Sys_Handle_Free **********************************************/
+
+/* Begin Function:Sys_Mem_Compact *********************************************
+Description : Compact the heap: walk it from the start, and slide each movable
+              block that follows a free run down over that run, so that the 
+              free run moves up and merges with the next one. Fixed blocks stay
+              where they are. Each block is moved, and its handle rewritten, with 
+              the interrupts locked; they are unlocked between blocks, so the 
+              interrupt-off time is bounded by the largest block.
+Input       : size_t Budget - Stop after moving about this many bytes. A pass 
+                              always moves at least one block, if it can.
+Output      : None.
+Return      : size_t - The number of bytes moved, also kept in Mem_Compact_Last.
+******************************************************************************/
+#if(ENABLE_MEM_HANDLE==TRUE)
+size_t Sys_Mem_Compact(size_t Budget)
+{
+    page_t Page;
+    page_t Dest;
+    page_t Pages;
+    page_t Free_Pages;
+    page_t Page_Cnt;
+    cnt_t Handle_Cnt;
+    size_t Moved;
+    tid_t TID;
+    
+    Moved=0;
+    Page=0;
+    Sys_Lock_Interrupt();
+    while(Page<DMEM_PAGES)
+    {
+        /* Skip free runs, and blocks that cannot or need not move */
+        if(MEM_IS_FREE(Page))
+        {
+            Page+=Mem.Mem_Len[Page];
+            continue;
+        }
+        Pages=Mem.Mem_Len[Page];
+        if((MEM_IS_MOVE(Page)==0)||(Page==0)||(MEM_IS_FREE(Page-1)==0))
+        {
+            Page+=Pages;
+            continue;
+        }
+        
+        /* Stop when the budget is spent, leaving the rest for the next pass */
+        if((Moved!=0)&&(Moved+Pages*PAGE_SIZE>Budget))
+        {
+            Sys_Unlock_Interrupt();
+            Mem.Mem_Compact_Last=Moved;
+            return Moved;
+        }
+        
+        /* Take over the free run before the block */
+        Free_Pages=Mem.Mem_Len[Page-1];
+        Dest=Page-Free_Pages;
+        _Sys_Mem_Unlink(&Mem.Mem_Free_Head,Dest);
+        
+        /* Move the data down. The regions may overlap */
+        Sys_Memmove_Xdata(&Mem.DMEM_Heap[Dest*PAGE_SIZE],&Mem.DMEM_Heap[Page*PAGE_SIZE],Pages*PAGE_SIZE);
+        
+        /* Move the block's records */
+        TID=Mem.Mem_CB[Page];
+        _Sys_Mem_Unlink(&Mem.Mem_Block_Head[TID],Page);
+        MEM_CLR_START(Page);
+        MEM_CLR_MOVE(Page);
+        for(Page_Cnt=Dest;Page_Cnt<Dest+Pages;Page_Cnt++)
+        {
+            MEM_CLR_FREE(Page_Cnt);
+            Mem.Mem_CB[Page_Cnt]=TID;
+        }
+        MEM_SET_START(Dest);
+        MEM_SET_MOVE(Dest);
+        Mem.Mem_Len[Dest]=Pages;
+        _Sys_Mem_Link(&Mem.Mem_Block_Head[TID],Dest);
+        for(Handle_Cnt=0;Handle_Cnt<MEM_HANDLES;Handle_Cnt++)
+        {
+            if(Mem.Mem_Handle[Handle_Cnt]==&Mem.DMEM_Heap[Page*PAGE_SIZE])
+                Mem.Mem_Handle[Handle_Cnt]=&Mem.DMEM_Heap[Dest*PAGE_SIZE];
+        }
+        
+        /* The free run is now after the block; merge it with what follows */
+        _Sys_Mem_Merge_Free(Dest+Pages,Free_Pages);
+        Moved+=Pages*PAGE_SIZE;
+        
+        /* Let the interrupts in between two blocks */
+        Sys_Unlock_Interrupt();
+        Sys_Lock_Interrupt();
+        Page=Dest+Pages;
+    }
     
-    /* See if this memory region can be freed by this thread */
-    if(Mem.Mem_CB[Page_Cnt]!=TID)
-        return;
-    if(Page_Cnt>0)
-        if(Mem.Mem_CB[Page_Cnt-1]!=0)
-            return;
+    /* A whole pass is done; nothing is left until the next free */
+    Mem.Mem_Compact_Pend=0;
+    Mem.Mem_Compact_Last=Moved;
+    Sys_Unlock_Interrupt();
+    return Moved;
+}
+#endif
+/* End Function:Sys_Mem_Compact **********************************************/
+
+/* Begin Function:Sys_Pool_Create *********************************************
+Description : Create a pool of fixed-size blocks, carved from the heap in the 
+              name of the kernel, so that the pool outlives its creator. 
+              Allocating and freeing its blocks then takes constant time and 
+              wastes no partial pages.
+Input       : struct Mem_Pool xdata* Pool - The pool control block to set up.
+              size_t Size - The size of each block, in bytes.
+              cnt_t Blocks - The number of blocks.
+Output      : None.
+Return      : retval_t - If there is no memory for the pool, -1; else 0.
+******************************************************************************/
+#if(ENABLE_MEM_POOL==TRUE)
+retval_t Sys_Pool_Create(struct Mem_Pool xdata* Pool,size_t Size,cnt_t Blocks)
+{
+    cnt_t Block_Cnt;
+    u8 xdata* Block;
     
-    /* Mark the area as free */
-	while(Mem.Mem_CB[Page_Cnt]==TID)
+    if((Size==0)||(Blocks==0))
+        return -1;
+    
+    /* A free block has to hold the link */
+    if(Size<sizeof(u8 xdata*))
+        Size=sizeof(u8 xdata*);
+    /* Make room for the owner TID */
+    Size+=sizeof(tid_t);
+    if(Size*Blocks/Blocks!=Size)
+        return -1;
+    
+    Pool->Base=(u8 xdata*)__Sys_Malloc(MEM_KERNEL,Size*Blocks);
+    if(Pool->Base==0)
+        return -1;
+    
+    Pool->Owner=Current_TID;
+    Pool->Block_Size=Size;
+    Pool->Block_Num=Blocks;
+    Pool->Free_Num=Blocks;
+    
+    /* Link all the blocks, first block first */
+    Pool->Free_Head=Pool->Base;
+    Block=Pool->Base;
+    for(Block_Cnt=0;Block_Cnt<Blocks;Block_Cnt++)
     {
-        Mem.Mem_CB[Page_Cnt]=0; 
-        Page_Cnt++;
+        *((tid_t xdata*)Block)=POOL_FREE;
+        if(Block_Cnt==Blocks-1)
+            *((u8 xdata* xdata*)(Block+sizeof(tid_t)))=0;
+        else
+            *((u8 xdata* xdata*)(Block+sizeof(tid_t)))=Block+Size;
+        Block+=Size;
     }
+    
+    Sys_Lock_Interrupt();
+    Pool->Next=Mem_Pool_List;
+    Mem_Pool_List=Pool;
+    Sys_Unlock_Interrupt();
+    return 0;
 }
 #endif
-/* End Function:__Sys_Mfree **************************************************/
+/* End Function:Sys_Pool_Create **********************************************/
 
-/* Begin Function:Sys_Mfree ***************************************************
-Description : Free the allocated memory. For application use.
-Input       : void xdata* Mem_Ptr -The pointer to the memory region that you want to free.
+/* Begin Function:Sys_Pool_Delete *********************************************
+Description : Give the memory of a pool back to the heap. This can only be done
+              by the thread that created the pool, or by any thread once that 
+              has ended, when all blocks are free.
+Input       : struct Mem_Pool xdata* Pool - The pool.
 Output      : None.
-Return      : None.
+Return      : retval_t - If blocks are still in use, or the pool belongs to 
+                         another thread, -1; else 0.
 ******************************************************************************/
-#if(ENABLE_MEMM==TRUE)
-void Sys_Mfree(void xdata* Mem_Ptr)
-{    
-    __Sys_Mfree(Current_TID,Mem_Ptr);
+#if(ENABLE_MEM_POOL==TRUE)
+retval_t Sys_Pool_Delete(struct Mem_Pool xdata* Pool)
+{
+    struct Mem_Pool xdata* xdata* Link;
+    
+    Sys_Lock_Interrupt();
+    if((Pool->Base==0)||(Pool->Free_Num!=Pool->Block_Num)||
+       ((Pool->Owner!=Current_TID)&&(Pool->Owner!=MEM_KERNEL)))
+    {
+        Sys_Unlock_Interrupt();
+        return -1;
+    }
+    
+    /* Take it out of the pool list */
+    Link=&Mem_Pool_List;
+    while(*Link!=Pool)
+        Link=&((*Link)->Next);
+    *Link=Pool->Next;
+    
+    __Sys_Mfree(MEM_KERNEL,Pool->Base);
+    Pool->Base=0;
+    Pool->Free_Head=0;
+    Pool->Free_Num=0;
+    Pool->Block_Num=0;
+    Sys_Unlock_Interrupt();
+    return 0;
 }
 #endif
-/* End Function:Sys_Mfree ****************************************************/
+/* End Function:Sys_Pool_Delete **********************************************/
 
-/* Begin Function:__Sys_Mfree_All *********************************************
-Description : Free all allocated memory of a certain thread.
-Input       : tid_t - The thread ID.
+/* Begin Function:_Sys_Pool_Free_All ******************************************
+Description : Free all pool blocks of a thread that is being killed, in every
+              pool, and give the pools it created to the kernel, so that any 
+              thread can delete them, and a thread that gets the TID later 
+              can't. This takes time bounded by the number of blocks in all the
+              pools. The caller holds the lock.
+Input       : tid_t TID - The thread ID.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-#if(ENABLE_MEMM==TRUE)
-void __Sys_Mfree_All(tid_t TID)
-{    
-    cnt_t Mem_Page_Cnt;
+#if(ENABLE_MEM_POOL==TRUE)
+void _Sys_Pool_Free_All(tid_t TID)
+{
+    struct Mem_Pool xdata* Pool;
+    u8 xdata* Block;
+    cnt_t Block_Cnt;
+    
+    for(Pool=Mem_Pool_List;Pool!=0;Pool=Pool->Next)
+    {
+        if(Pool->Owner==TID)
+            Pool->Owner=MEM_KERNEL;
+        
+        Block=Pool->Base;
+        for(Block_Cnt=0;Block_Cnt<Pool->Block_Num;Block_Cnt++)
+        {
+            if(*((tid_t xdata*)Block)==TID)
+            {
+                *((tid_t xdata*)Block)=POOL_FREE;
+                *((u8 xdata* xdata*)(Block+sizeof(tid_t)))=Pool->Free_Head;
+                Pool->Free_Head=Block;
+                Pool->Free_Num++;
+            }
+            Block+=Pool->Block_Size;
+        }
+    }
+}
+#endif
+/* End Function:_Sys_Pool_Free_All *******************************************/
+
+/* Begin Function:__Sys_Pool_Alloc ********************************************
+Description : Allocate a block from a pool in the name of a certain thread, in 
+              constant time.
+Input       : tid_t TID - The thread ID.
+              struct Mem_Pool xdata* Pool - The pool.
+Output      : None.
+Return      : void xdata* - The pointer to the block. If the pool is empty, 0.
+******************************************************************************/
+#if(ENABLE_MEM_POOL==TRUE)
+void xdata* __Sys_Pool_Alloc(tid_t TID,struct Mem_Pool xdata* Pool)
+{
+    u8 xdata* Block;
     
-    /* See if the TID is valid in the system */   
     if(TID>=MAX_THREADS)
+        return ((void*)0);
+    
+    Sys_Lock_Interrupt();
+    Block=Pool->Free_Head;
+    if(Block==0)
+    {
+        Sys_Unlock_Interrupt();
+        return ((void*)0);
+    }
+    
+    Pool->Free_Head=*((u8 xdata* xdata*)(Block+sizeof(tid_t)));
+    Pool->Free_Num--;
+    *((tid_t xdata*)Block)=TID;
+    Sys_Unlock_Interrupt();
+    
+    return (void xdata*)(Block+sizeof(tid_t));
+}
+#endif
+/* End Function:__Sys_Pool_Alloc *********************************************/
+
+/* Begin Function:Sys_Pool_Alloc **********************************************
+Description : Allocate a block from a pool. For application use.
+Input       : struct Mem_Pool xdata* Pool - The pool.
+Output      : None.
+Return      : void xdata* - The pointer to the block. If the pool is empty, 0.
+******************************************************************************/
+#if(ENABLE_MEM_POOL==TRUE)
+void xdata* Sys_Pool_Alloc(struct Mem_Pool xdata* Pool)
+{
+    return __Sys_Pool_Alloc(Current_TID,Pool);
+}
+#endif
+/* End Function:Sys_Pool_Alloc ***********************************************/
+
+/* Begin Function:__Sys_Pool_Free *********************************************
+Description : Free a pool block in the name of a certain thread, in constant time.
+              As with __Sys_Mfree, the pointer must be the start of a block in 
+              use by that thread, or nothing happens.
+Input       : tid_t TID - The thread ID.
+              struct Mem_Pool xdata* Pool - The pool.
+              void xdata* Mem_Ptr - The pointer to the block.
+Output      : None.
+Return      : None.
+******************************************************************************/
+#if(ENABLE_MEM_POOL==TRUE)
+void __Sys_Pool_Free(tid_t TID,struct Mem_Pool xdata* Pool,void xdata* Mem_Ptr)
+{
+    u8 xdata* Block;
+    
+    if((Mem_Ptr==0)||(TID>=MAX_THREADS))
+        return;
+    
+    /* See if the pointer is the start of a block in this pool */
+    Block=(u8 xdata*)Mem_Ptr-sizeof(tid_t);
+    if((Block<Pool->Base)||(Block>=Pool->Base+Pool->Block_Size*Pool->Block_Num))
+        return;
+    if(((ptr_int_t)(Block-Pool->Base))%Pool->Block_Size!=0)
         return;
     
-    /* Mark all the memory allocated by it as free */
-    for(Mem_Page_Cnt=0;Mem_Page_Cnt<DMEM_PAGES;Mem_Page_Cnt++)
+    Sys_Lock_Interrupt();
+    /* See if this block can be freed by this thread */
+    if(*((tid_t xdata*)Block)!=TID)
     {
-        if(Mem.Mem_CB[Mem_Page_Cnt]==TID)
-            Mem.Mem_CB[Mem_Page_Cnt]=0;
+        Sys_Unlock_Interrupt();
+        return;
     }
+    
+    *((tid_t xdata*)Block)=POOL_FREE;
+    *((u8 xdata* xdata*)Mem_Ptr)=Pool->Free_Head;
+    Pool->Free_Head=Block;
+    Pool->Free_Num++;
+    Sys_Unlock_Interrupt();
 }
 #endif
-/* End Function:__Sys_Mfree_All **********************************************/
+/* End Function:__Sys_Pool_Free **********************************************/
 
-/* Begin Function:Sys_Mfree_All ***********************************************
-Description : Free all allocated memory.
-Input       : None.
+/* Begin Function:Sys_Pool_Free ***********************************************
+Description : Free a pool block. For application use.
+Input       : struct Mem_Pool xdata* Pool - The pool.
+              void xdata* Mem_Ptr - The pointer to the block.
 Output      : None.
 Return      : None.
 ******************************************************************************/
-#if(ENABLE_MEMM==TRUE)
-void Sys_Mfree_All(void)
-{    
-    __Sys_Mfree_All(Current_TID);
+#if(ENABLE_MEM_POOL==TRUE)
+void Sys_Pool_Free(struct Mem_Pool xdata* Pool,void xdata* Mem_Ptr)
+{
+    __Sys_Pool_Free(Current_TID,Pool,Mem_Ptr);
 }
 #endif
-/* End Function:Sys_Mfree_All ************************************************/
+/* End Function:Sys_Pool_Free ************************************************/
 
 /* End Of File ***************************************************************/
 